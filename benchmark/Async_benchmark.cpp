@@ -0,0 +1,103 @@
+#include <chrono>
+#include <deque>
+#include <future>
+#include <random>
+#include <thread>
+#include <vector>
+#include <Histogram.hpp>
+#include <KeyValueStore.hpp>
+
+/* request threads look up a hot set of cached keys, and every tenth time a
+   key evicted to the disk; once with retrieve() and once with
+   retrieve_async(), whose misses are collected later. Reports throughput and
+   the time between two hits answered on a request thread, which grows by
+   every miss the thread waits for in between */
+struct Run {
+  double ops_s;
+  Histogram hit_gaps;
+  uint64_t misses;
+};
+
+size_t const number_of_keys = 100000;
+size_t const hot_keys = 5000;
+size_t const value_size = 100;
+size_t const operations = 100000;
+size_t const request_threads = 2;
+size_t const io_threads = 2;
+// miss futures a request thread keeps before it waits for the oldest one
+size_t const in_flight = 64;
+
+Run run(bool const async) {
+  KeyValueStore<LRU> key_value_store(
+    2 * hot_keys * (value_size + 6), 16, 0, Cache::Storage::Heap,
+    Disk::Lifetime::Temporary, 0, async ? io_threads : 0);
+  // the cold keys first, so that the hot ones stay cached
+  for (size_t i = number_of_keys; i > 0; i--)
+    key_value_store.record(to_string(i - 1), string(value_size, 'v'));
+
+  vector<Histogram> gaps(request_threads);
+  vector<uint64_t> misses(request_threads);
+  vector<thread> threads;
+  auto const begin = chrono::steady_clock::now();
+  for (size_t id = 0; id < request_threads; id++) {
+    threads.emplace_back([&, id] () -> void {
+      mt19937_64 random(id + 1);
+      uniform_int_distribution<size_t> hot(0, hot_keys - 1);
+      uniform_int_distribution<size_t> cold(hot_keys, number_of_keys - 1);
+      deque<future<shared_ptr<string const>>> pending;
+      auto last_hit = chrono::steady_clock::now();
+      for (size_t i = 0; i < operations; i++) {
+        bool const miss = i % 10 == 9;
+        string const key = to_string(miss ? cold(random) : hot(random));
+        if (async) {
+          auto value = key_value_store.retrieve_async(key);
+          if (miss) {
+            pending.push_back(move(value));
+            if (pending.size() > in_flight) {
+              pending.front().get();
+              pending.pop_front();
+            }
+          } else {
+            value.get();
+          }
+        } else {
+          key_value_store.retrieve_shared(key);
+        }
+        misses[id] += miss;
+        if (!miss) {
+          auto const now = chrono::steady_clock::now();
+          gaps[id].record(static_cast<uint64_t>(
+            chrono::duration_cast<chrono::nanoseconds>(now - last_hit)
+              .count()));
+          last_hit = now;
+        }
+      }
+      for (auto & value : pending)
+        value.get();
+    });
+  }
+  for (auto & thread : threads)
+    thread.join();
+  chrono::duration<double> const elapsed = chrono::steady_clock::now() - begin;
+  Run result{request_threads * operations / elapsed.count(), Histogram{}, 0};
+  for (size_t id = 0; id < request_threads; id++) {
+    result.hit_gaps.merge(gaps[id]);
+    result.misses += misses[id];
+  }
+  return result;
+}
+
+int main() {
+  cout << "retrieve\tops/s\tmisses\thit gap p50 ns\thit gap p99 ns"
+       << "\thit gap p999 ns" << endl;
+  for (bool const async : {false, true}) {
+    Run const result = run(async);
+    cout << (async ? "async" : "sync") << '\t'
+         << static_cast<size_t>(result.ops_s) << '\t' << result.misses << '\t'
+         << result.hit_gaps.percentile(0.5) << '\t'
+         << result.hit_gaps.percentile(0.99) << '\t'
+         << result.hit_gaps.percentile(0.999) << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <Disk.hpp>
+
+/* writes JSON-like values to a disk once without and once with block
+   compression, compacts every sealed segment and reports write throughput,
+   bytes on disk and random read throughput over all keys and over a hot
+   tenth of them */
+struct Run {
+  double write_mb_s;
+  size_t bytes;
+  double reads_s;
+  double hot_reads_s;
+};
+
+size_t const number_of_keys = 200000;
+size_t const reads = 200000;
+
+string value(size_t const i) {
+  return "{\"id\": " + to_string(i) + ", \"user\": \"user" + to_string(i % 977) +
+         "\", \"email\": \"user" + to_string(i % 977) + "@example.com\", " +
+         "\"active\": " + (i % 3 == 0 ? "false" : "true") + ", \"tags\": " +
+         "[\"alpha\", \"beta\", \"gamma\"], \"score\": " + to_string(i % 101) +
+         ", \"address\": {\"street\": \"" + to_string(i % 300) +
+         " Main Street\", \"city\": \"Springfield\", \"zip\": \"" +
+         to_string(10000 + i % 90000) + "\"}}";
+}
+
+double read_all(Disk & disk, size_t const keys, mt19937_64 & random) {
+  uniform_int_distribution<size_t> key(0, keys - 1);
+  size_t found{0};
+  auto const begin = chrono::steady_clock::now();
+  for (size_t i = 0; i < reads; i++)
+    found += disk.view(to_string(key(random))).has_value();
+  chrono::duration<double> const elapsed = chrono::steady_clock::now() - begin;
+  if (found != reads)
+    cerr << "missing values" << endl;
+  return reads / elapsed.count();
+}
+
+Run run(Disk::Compression const compression) {
+  Disk disk(Disk::default_compaction_ratio, Disk::default_segment_bytes,
+            Disk::Reads::Mapped, Disk::Lifetime::Temporary, 0, compression);
+  size_t written{0};
+  auto const begin = chrono::steady_clock::now();
+  vector<pair<string, string>> batch;
+  for (size_t i = 0; i < number_of_keys; i++) {
+    batch.emplace_back(to_string(i), value(i));
+    written += batch.back().first.length() + batch.back().second.length();
+    if (batch.size() == 100) {
+      disk.put(batch);
+      batch.clear();
+    }
+  }
+  disk.put(batch);
+  disk.compact();
+  chrono::duration<double> const elapsed = chrono::steady_clock::now() - begin;
+  mt19937_64 random(1);
+  return Run{written / elapsed.count() / 1e6, disk.size(),
+             read_all(disk, number_of_keys, random),
+             read_all(disk, number_of_keys / 10, random)};
+}
+
+int main() {
+  Run const none = run(Disk::Compression::None);
+  Run const blocks = run(Disk::Compression::Blocks);
+  cout << "compression\twrite MB/s\tbytes\treads/s\thot reads/s" << endl
+       << "none\t" << none.write_mb_s << '\t' << none.bytes << '\t'
+       << static_cast<size_t>(none.reads_s) << '\t'
+       << static_cast<size_t>(none.hot_reads_s) << endl
+       << "blocks\t" << blocks.write_mb_s << '\t' << blocks.bytes << '\t'
+       << static_cast<size_t>(blocks.reads_s) << '\t'
+       << static_cast<size_t>(blocks.hot_reads_s) << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <KeyValueStore.hpp>
+
+/* time a store needs after a restart until its cache hit ratio is steady
+   again: once reopened from its snapshot and disk, once started empty; a
+   miss reads the value from an imaginary backing store, which takes
+   "miss_us" microseconds, and records it */
+struct Run {
+  double open_ms;
+  double steady_ms;
+  size_t windows;
+};
+
+size_t const number_of_keys = 100000;
+size_t const value_size = 100;
+size_t const window = 10000;
+// a window counts as steady from 95% of the hit ratio before the restart
+double const steady_share = 0.95;
+
+// Zipfian key ids with skew 0.99, hottest keys first
+vector<double> weights() {
+  vector<double> weights(number_of_keys);
+  for (size_t i = 0; i < number_of_keys; i++)
+    weights[i] = 1.0 / pow(static_cast<double>(i + 1), 0.99);
+  return weights;
+}
+
+// cache hit ratio of "window" read-through retrievals
+template<typename Strategy>
+double run_window(KeyValueStore<Strategy> & key_value_store,
+                  discrete_distribution<size_t> & keys, mt19937_64 & random,
+                  size_t const miss_us) {
+  size_t hits{0};
+  for (size_t i = 0; i < window; i++) {
+    string const key = to_string(keys(random));
+    hits += key_value_store.cache.get(key).has_value();
+    if (!key_value_store.retrieve(key).has_value()) {
+      auto const until = chrono::steady_clock::now() +
+                         chrono::microseconds(miss_us);
+      while (chrono::steady_clock::now() < until) {}
+      key_value_store.record(key, string(value_size, 'v'));
+    }
+  }
+  return static_cast<double>(hits) / window;
+}
+
+template<typename Strategy>
+Run restart(Disk::Lifetime const lifetime, double const steady,
+            discrete_distribution<size_t> & keys, mt19937_64 & random,
+            size_t const miss_us) {
+  size_t const bytes = number_of_keys * value_size / 4;
+  auto const begin = chrono::steady_clock::now();
+  KeyValueStore<Strategy> key_value_store(bytes, 1, 0, Cache::Storage::Heap,
+                                          lifetime);
+  chrono::duration<double, milli> const open =
+    chrono::steady_clock::now() - begin;
+  size_t windows{0};
+  while (windows < 100) {
+    ++windows;
+    if (run_window(key_value_store, keys, random, miss_us) >=
+        steady * steady_share)
+      break;
+  }
+  chrono::duration<double, milli> const elapsed =
+    chrono::steady_clock::now() - begin;
+  if (lifetime == Disk::Lifetime::Persistent)
+    key_value_store.delAll();
+  return Run{open.count(), elapsed.count(), windows};
+}
+
+int main(int argc, char* argv[]) {
+  size_t const miss_us = argc > 1 ? stoul(argv[1]) : 20;
+  auto const distribution = weights();
+  discrete_distribution<size_t> keys(distribution.begin(), distribution.end());
+  mt19937_64 random(1);
+  size_t const bytes = number_of_keys * value_size / 4;
+
+  // the hit ratio the store settles at, before it is shut down
+  double steady{0};
+  {
+    KeyValueStore<LRU> key_value_store(bytes, 1, 0, Cache::Storage::Heap,
+                                       Disk::Lifetime::Persistent);
+    key_value_store.delAll();
+    for (size_t i = 0; i < 20; i++)
+      steady = run_window(key_value_store, keys, random, 0);
+  }
+
+  Run const warm = restart<LRU>(Disk::Lifetime::Persistent, steady, keys,
+                                random, miss_us);
+  Run const cold = restart<LRU>(Disk::Lifetime::Temporary, steady, keys,
+                                random, miss_us);
+  cout << "steady hit ratio\t" << steady << endl
+       << "start\topen_ms\tsteady_ms\twindows of " << window << endl
+       << "warm\t" << warm.open_ms << '\t' << warm.steady_ms << '\t'
+       << warm.windows << endl
+       << "cold\t" << cold.open_ms << '\t' << cold.steady_ms << '\t'
+       << cold.windows << endl;
+  // left by the warm store, which was emptied
+  remove("Storage_snapshot");
+  remove("Storage_snapshot.deleted");
+  remove("Storage_index");
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <KeyValueStore.hpp>
+
+// throughput of a hit-heavy LRU workload for a growing number of threads,
+// once with a single shard and once with a shard per thread
+template<typename Strategy>
+double run(size_t const number_of_threads, size_t const number_of_shards,
+           size_t const number_of_keys, size_t const operations) {
+  KeyValueStore<Strategy> key_value_store(number_of_keys * 64,
+                                          number_of_shards);
+  for (size_t i = 0; i < number_of_keys; i++)
+    key_value_store.record(to_string(i), string(16, 'v'));
+
+  atomic<bool> start{false};
+  vector<thread> threads;
+  for (size_t id = 0; id < number_of_threads; id++) {
+    threads.emplace_back([&, id] () -> void {
+      size_t state = id + 1;
+      while (!start.load()) {}
+      for (size_t i = 0; i < operations; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        string const key = to_string((state >> 33) % number_of_keys);
+        if (i % 10 == 0)
+          key_value_store.record(key, string(16, 'w'));
+        else
+          key_value_store.retrieve(key);
+      }
+    });
+  }
+  auto const begin = chrono::steady_clock::now();
+  start.store(true);
+  for (auto & thread : threads)
+    thread.join();
+  chrono::duration<double> const elapsed = chrono::steady_clock::now() - begin;
+  return static_cast<double>(number_of_threads * operations) / elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+  size_t const max_threads = argc > 1
+    ? stoul(argv[1])
+    : max<size_t>(thread::hardware_concurrency(), 1);
+  size_t const number_of_keys = 100000;
+  size_t const operations = 200000;
+
+  cout << "threads\tshards\tops/s(1 shard)\tops/s(sharded)" << endl;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    size_t const shards = threads * 4;
+    cout << threads << '\t' << shards << '\t'
+         << static_cast<size_t>(run<LRU>(threads, 1, number_of_keys,
+                                         operations)) << '\t'
+         << static_cast<size_t>(run<LRU>(threads, shards, number_of_keys,
+                                         operations)) << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
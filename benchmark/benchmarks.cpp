@@ -0,0 +1,388 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <Histogram.hpp>
+#include <KeyValueStore.hpp>
+
+string const usage{
+  "benchmarks [options]\n"
+  "  --subjects LIST    comma separated: Cache,LockFreeCache,Disk,FIFO,LRU,\n"
+  "                     LFU,ARC,2Q,W-TinyLFU,CLOCK (all)\n"
+  "  --workloads LIST   comma separated: uniform,zipfian,read,scan,write\n"
+  "                     (all)\n"
+  "  --keys N           number of distinct keys (10000)\n"
+  "  --key-size N       key length in bytes (16)\n"
+  "  --value-size N     value length in bytes (100)\n"
+  "  --threads LIST     comma separated thread counts (1)\n"
+  "  --ops N            operations per thread (20000)\n"
+  "  --cache-bytes N    KeyValueStore budget (a quarter of the data set)\n"
+  "  --shards N         KeyValueStore shards (1)\n"
+  "  --compress N       KeyValueStore compresses cached values from N bytes\n"
+  "                     on (0, off)\n"
+  "  --format F         table, csv or json (table)"};
+
+struct Options {
+  vector<string> subjects{"Cache", "LockFreeCache", "Disk", "FIFO", "LRU",
+                          "LFU", "ARC", "2Q", "W-TinyLFU", "CLOCK"};
+  vector<string> workloads{"uniform", "zipfian", "read", "scan", "write"};
+  size_t keys{10000};
+  size_t key_size{16};
+  size_t value_size{100};
+  vector<size_t> threads{1};
+  size_t ops{20000};
+  size_t cache_bytes{0};
+  size_t shards{1};
+  size_t compress{0};
+  string format{"table"};
+};
+
+struct Result {
+  string subject;
+  string workload;
+  size_t threads;
+  uint64_t operations;
+  double seconds;
+  Histogram latency;
+  uint64_t reads;
+  uint64_t hits;
+};
+
+// one operation chosen by a workload for a thread
+struct Operation {
+  size_t key;
+  bool write;
+};
+
+vector<string> split(string const& list) {
+  vector<string> items;
+  stringstream stream(list);
+  string item;
+  while (getline(stream, item, ','))
+    items.push_back(item);
+  return items;
+}
+
+string make_key(size_t const id, size_t const key_size) {
+  string key = to_string(id);
+  if (key.length() < key_size)
+    key.insert(0, key_size - key.length(), 'k');
+  return key;
+}
+
+string make_value(size_t const id, size_t const value_size) {
+  string value(value_size, 'v');
+  for (size_t i = 0; i < value_size; i += 8)
+    value[i] = static_cast<char>('a' + (id + i) % 26);
+  return value;
+}
+
+/* Zipfian key ids with skew "theta" as in YCSB (Gray et al., "Quickly
+   generating billion-record synthetic databases"), hottest keys first */
+class Zipfian final {
+ private:
+  size_t const n;
+  double const theta;
+  double zetan{0};
+  double alpha;
+  double eta;
+
+ public:
+  explicit Zipfian(size_t const n, double const theta = 0.99)
+    : n(n), theta(theta) {
+    for (size_t i = 1; i <= n; i++)
+      zetan += 1.0 / pow(static_cast<double>(i), theta);
+    double const zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - pow(2.0 / static_cast<double>(n), 1.0 - theta)) /
+          (1.0 - zeta2 / zetan);
+  }
+
+  size_t operator()(double const u) const {
+    double const uz = u * zetan;
+    if (uz < 1.0)
+      return 0;
+    if (uz < 1.0 + pow(0.5, theta))
+      return 1;
+    return min(n - 1, static_cast<size_t>(
+      static_cast<double>(n) * pow(eta * u - eta + 1.0, alpha)));
+  }
+};
+
+// a generator of operations for one thread
+using Generator = function<Operation()>;
+
+Generator make_generator(string const& workload, Options const& options,
+                         Zipfian const& zipfian, size_t const id,
+                         size_t const threads) {
+  auto random = make_shared<mt19937_64>(id * 7919 + 1);
+  size_t const keys = options.keys;
+  if (workload == "uniform") {
+    // 95% reads over uniformly chosen keys
+    return [random, keys] () -> Operation {
+      return {(*random)() % keys, (*random)() % 100 < 5};
+    };
+  } else if (workload == "zipfian") {
+    // 95% reads over keys with a skewed popularity
+    return [random, &zipfian] () -> Operation {
+      double const u = uniform_real_distribution<double>(0, 1)(*random);
+      return {zipfian(u), (*random)() % 100 < 5};
+    };
+  } else if (workload == "read") {
+    // reads only over keys with a skewed popularity
+    return [random, &zipfian] () -> Operation {
+      double const u = uniform_real_distribution<double>(0, 1)(*random);
+      return {zipfian(u), false};
+    };
+  } else if (workload == "scan") {
+    // every thread reads the whole key space in order, over and over
+    auto next = make_shared<size_t>(id * keys / threads);
+    return [next, keys] () -> Operation {
+      return {(*next)++ % keys, false};
+    };
+  } else if (workload == "write") {
+    // 80% writes over uniformly chosen keys
+    return [random, keys] () -> Operation {
+      return {(*random)() % keys, (*random)() % 100 < 80};
+    };
+  }
+  throw invalid_argument("unknown workload " + workload);
+}
+
+/* runs "options.ops" operations on every thread, "read" reports whether the
+   key was found and "hit" whether it was found in the first tier */
+Result run(string const& subject, string const& workload, size_t const threads,
+           Options const& options, Zipfian const& zipfian,
+           function<bool(string const&, bool &)> const& read,
+           function<void(string const&, string const&)> const& write) {
+  vector<string> keys, values;
+  for (size_t i = 0; i < options.keys; i++) {
+    keys.push_back(make_key(i, options.key_size));
+    values.push_back(make_value(i, options.value_size));
+  }
+  for (size_t i = 0; i < options.keys; i++)
+    write(keys[i], values[i]);
+
+  vector<Histogram> latencies(threads);
+  vector<uint64_t> reads(threads), hits(threads);
+  atomic<bool> start{false};
+  vector<thread> workers;
+  for (size_t id = 0; id < threads; id++) {
+    workers.emplace_back([&, id] () -> void {
+      Generator next = make_generator(workload, options, zipfian, id,
+                                      threads);
+      while (!start.load()) {}
+      for (size_t i = 0; i < options.ops; i++) {
+        Operation const operation = next();
+        auto const begin = chrono::steady_clock::now();
+        bool hit{false};
+        if (operation.write) {
+          write(keys[operation.key], values[operation.key]);
+        } else {
+          read(keys[operation.key], hit);
+        }
+        auto const end = chrono::steady_clock::now();
+        latencies[id].record(static_cast<uint64_t>(
+          chrono::duration_cast<chrono::nanoseconds>(end - begin).count()));
+        if (!operation.write) {
+          ++reads[id];
+          hits[id] += hit;
+        }
+      }
+    });
+  }
+  auto const begin = chrono::steady_clock::now();
+  start.store(true);
+  for (auto & worker : workers)
+    worker.join();
+  chrono::duration<double> const elapsed = chrono::steady_clock::now() - begin;
+
+  Result result{subject, workload, threads, 0, elapsed.count(), {}, 0, 0};
+  for (size_t id = 0; id < threads; id++) {
+    result.latency.merge(latencies[id]);
+    result.reads += reads[id];
+    result.hits += hits[id];
+  }
+  result.operations = result.latency.count();
+  return result;
+}
+
+template<typename Strategy>
+Result run_key_value_store(string const& subject, string const& workload,
+                           size_t const threads, Options const& options,
+                           Zipfian const& zipfian) {
+  KeyValueStore<Strategy> key_value_store(options.cache_bytes, options.shards,
+                                          0, Cache::Storage::Heap,
+                                          Disk::Lifetime::Temporary,
+                                          options.compress);
+  return run(subject, workload, threads, options, zipfian,
+    [&key_value_store] (string const& key, bool & hit) -> bool {
+      /* a hit is a key resident right before retrieve, the probe is part of
+         the measured latency and approximate under concurrent writers */
+      hit = key_value_store.cache.get(key).has_value();
+      return key_value_store.retrieve(key).has_value();
+    },
+    [&key_value_store] (string const& key, string const& value) -> void {
+      key_value_store.record(key, value);
+    });
+}
+
+Result run_subject(string const& subject, string const& workload,
+                   size_t const threads, Options const& options,
+                   Zipfian const& zipfian) {
+  if (subject == "Cache") {
+    Cache cache(options.shards);
+    return run(subject, workload, threads, options, zipfian,
+      [&cache] (string const& key, bool & hit) -> bool {
+        return hit = cache.get(key).has_value();
+      },
+      [&cache] (string const& key, string const& value) -> void {
+        cache.put(key, value);
+      });
+  } else if (subject == "LockFreeCache") {
+    Cache cache(options.shards, Cache::Storage::Heap, Cache::Lookups::LockFree);
+    return run(subject, workload, threads, options, zipfian,
+      [&cache] (string const& key, bool & hit) -> bool {
+        return hit = cache.get(key).has_value();
+      },
+      [&cache] (string const& key, string const& value) -> void {
+        cache.put(key, value);
+      });
+  } else if (subject == "Disk") {
+    Disk disk;
+    return run(subject, workload, threads, options, zipfian,
+      [&disk] (string const& key, bool & hit) -> bool {
+        return hit = disk.get(key).has_value();
+      },
+      [&disk] (string const& key, string const& value) -> void {
+        disk.put(key, value);
+      });
+  } else if (subject == "FIFO") {
+    return run_key_value_store<FIFO>(subject, workload, threads, options,
+                                     zipfian);
+  } else if (subject == "LRU") {
+    return run_key_value_store<LRU>(subject, workload, threads, options,
+                                    zipfian);
+  } else if (subject == "LFU") {
+    return run_key_value_store<LFU>(subject, workload, threads, options,
+                                    zipfian);
+  } else if (subject == "ARC") {
+    return run_key_value_store<ARC>(subject, workload, threads, options,
+                                    zipfian);
+  } else if (subject == "2Q") {
+    return run_key_value_store<TwoQ>(subject, workload, threads, options,
+                                     zipfian);
+  } else if (subject == "W-TinyLFU") {
+    return run_key_value_store<WTinyLFU>(subject, workload, threads, options,
+                                         zipfian);
+  } else if (subject == "CLOCK") {
+    return run_key_value_store<CLOCK>(subject, workload, threads, options,
+                                      zipfian);
+  }
+  throw invalid_argument("unknown subject " + subject);
+}
+
+void print(Result const& result, string const& format, bool const first) {
+  double const throughput =
+    static_cast<double>(result.operations) / result.seconds;
+  double const hit_ratio = result.reads == 0 ? 0.0
+    : static_cast<double>(result.hits) / static_cast<double>(result.reads);
+  double const p50 = result.latency.percentile(0.5) / 1000.0;
+  double const p99 = result.latency.percentile(0.99) / 1000.0;
+  double const p999 = result.latency.percentile(0.999) / 1000.0;
+  if (format == "json") {
+    cout << "{\"subject\":\"" << result.subject << "\","
+         << "\"workload\":\"" << result.workload << "\","
+         << "\"threads\":" << result.threads << ','
+         << "\"operations\":" << result.operations << ','
+         << "\"seconds\":" << result.seconds << ','
+         << "\"ops_per_second\":" << throughput << ','
+         << "\"p50_us\":" << p50 << ','
+         << "\"p99_us\":" << p99 << ','
+         << "\"p999_us\":" << p999 << ','
+         << "\"hit_ratio\":" << hit_ratio << '}' << endl;
+  } else {
+    char const separator = format == "csv" ? ',' : '\t';
+    if (first) {
+      cout << "subject" << separator << "workload" << separator
+           << "threads" << separator << "ops/s" << separator
+           << "p50_us" << separator << "p99_us" << separator
+           << "p999_us" << separator << "hit_ratio" << endl;
+    }
+    cout << result.subject << separator << result.workload << separator
+         << result.threads << separator
+         << static_cast<uint64_t>(throughput) << separator
+         << p50 << separator << p99 << separator << p999 << separator
+         << hit_ratio << endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  try {
+    for (int i = 1; i < argc; i++) {
+      string const option{argv[i]};
+      if (option == "-h" || option == "--help") {
+        cout << usage << endl;
+        return EXIT_SUCCESS;
+      } else if (i + 1 >= argc) {
+        throw invalid_argument("missing value of " + option);
+      }
+      string const value{argv[++i]};
+      if (option == "--subjects") {
+        options.subjects = split(value);
+      } else if (option == "--workloads") {
+        options.workloads = split(value);
+      } else if (option == "--keys") {
+        options.keys = max<size_t>(stoul(value), 1);
+      } else if (option == "--key-size") {
+        options.key_size = stoul(value);
+      } else if (option == "--value-size") {
+        options.value_size = stoul(value);
+      } else if (option == "--threads") {
+        options.threads.clear();
+        for (auto const& count : split(value))
+          options.threads.push_back(max<size_t>(stoul(count), 1));
+      } else if (option == "--ops") {
+        options.ops = stoul(value);
+      } else if (option == "--cache-bytes") {
+        options.cache_bytes = stoul(value);
+      } else if (option == "--shards") {
+        options.shards = stoul(value);
+      } else if (option == "--compress") {
+        options.compress = stoul(value);
+      } else if (option == "--format") {
+        options.format = value;
+      } else {
+        throw invalid_argument("unknown option " + option);
+      }
+    }
+    if (options.cache_bytes == 0)
+      options.cache_bytes =
+        options.keys * (options.key_size + options.value_size) / 4;
+
+    Zipfian const zipfian(options.keys);
+    bool first{true};
+    for (auto const& subject : options.subjects) {
+      for (auto const& workload : options.workloads) {
+        for (auto const threads : options.threads) {
+          print(run_subject(subject, workload, threads, options, zipfian),
+                options.format, first);
+          first = false;
+        }
+      }
+    }
+  } catch (invalid_argument const& e) {
+    cout << "Error: " << e.what() << endl << usage << endl;
+    return EXIT_FAILURE;
+  } catch (ios::failure const& e) {
+    cout << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
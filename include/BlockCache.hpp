@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+/* decompressed blocks of the disk by segment and offset, up to "capacity"
+   bytes of them, the least recently used one is dropped first; readers keep
+   the blocks they hold alive */
+class BlockCache final {
+ public:
+  // lookups answered from the cache and lookups that had to decompress
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+ private:
+  using Id = pair<size_t, int64_t>;
+
+  struct IdHash {
+    size_t operator()(Id const& id) const {
+      return hash<size_t>{}(id.first) * 31 + hash<int64_t>{}(id.second);
+    }
+  };
+
+  size_t const capacity;
+  size_t bytes{0};
+  list<pair<Id, shared_ptr<string const>>> blocks;
+  unordered_map<Id, decltype(blocks)::iterator, IdHash> positions;
+  uint64_t hits{0};
+  uint64_t misses{0};
+  std::mutex mutex;
+
+ public:
+  explicit BlockCache(size_t const capacity) : capacity(capacity) {}
+  ~BlockCache() = default;
+  BlockCache(BlockCache const&) = delete;
+  BlockCache(BlockCache &&) noexcept = delete;
+  BlockCache &operator=(BlockCache const&) = delete;
+  BlockCache &operator=(BlockCache &&) noexcept = delete;
+
+  shared_ptr<string const> get(size_t const segment, int64_t const offset) {
+    lock_guard<std::mutex> lock(mutex);
+    auto const it = positions.find(Id{segment, offset});
+    if (it == positions.end()) {
+      ++misses;
+      return nullptr;
+    }
+    ++hits;
+    blocks.splice(blocks.begin(), blocks, it->second);
+    return it->second->second;
+  }
+
+  void put(size_t const segment, int64_t const offset,
+           shared_ptr<string const> block) {
+    lock_guard<std::mutex> lock(mutex);
+    if (block->length() > capacity ||
+        positions.count(Id{segment, offset}) > 0) {
+      return;
+    }
+    bytes += block->length();
+    blocks.emplace_front(Id{segment, offset}, move(block));
+    positions.emplace(Id{segment, offset}, blocks.begin());
+    while (bytes > capacity) {
+      bytes -= blocks.back().second->length();
+      positions.erase(blocks.back().first);
+      blocks.pop_back();
+    }
+  }
+
+  // the segment was rewritten, its offsets mean other blocks now
+  void drop(size_t const segment) {
+    lock_guard<std::mutex> lock(mutex);
+    for (auto it = blocks.begin(); it != blocks.end();) {
+      if (it->first.first == segment) {
+        bytes -= it->second->length();
+        positions.erase(it->first);
+        it = blocks.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void clear() {
+    lock_guard<std::mutex> lock(mutex);
+    blocks.clear();
+    positions.clear();
+    bytes = 0;
+  }
+
+  Stats stats() {
+    lock_guard<std::mutex> lock(mutex);
+    return Stats{hits, misses};
+  }
+};
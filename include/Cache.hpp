@@ -1,88 +1,490 @@
 #pragma once
 
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
 #include <unordered_map>
 #include <shared_mutex>
+#include <ConcurrentIndex.hpp>
+#include <Hook.hpp>
+#include <Lz.hpp>
+#include <Slab.hpp>
 
 using namespace std;
 
 class Cache final {
+ public:
+  /* where entries live and what the byte budget counts: "Heap" counts the
+     key and value lengths, "Slab" places table nodes, keys and value blocks
+     in size-classed slabs and counts every byte they occupy */
+  enum class Storage { Heap, Slab };
+
+  /* how get, share and get_with find values: "Locked" read-locks the shard,
+     "LockFree" looks them up in an index mirroring the shard, which readers
+     traverse without locks under an Epoch::Guard */
+  enum class Lookups { Locked, LockFree };
+
+  // frees a key with the allocator it came from
+  struct KeyDeleter {
+    Slab* slab;
+    size_t length;
+
+    void operator()(char* const key) const noexcept {
+      if (slab != nullptr) {
+        slab->deallocate(key, length);
+      } else {
+        delete[] key;
+      }
+    }
+  };
+
+  /* one node per key, shared by the table and the eviction order through
+     its hook; values are immutable buffers shared with whoever read them,
+     keys are owned by the entry and viewed by the table and the hook, so
+     that lookups by string_view need no temporary string; a "compressed"
+     value is kept in the form Lz::compress gave it */
+  struct Entry : Hook {
+    unique_ptr<char[], KeyDeleter> owned_key;
+    shared_ptr<string const> value;
+    size_t footprint;
+    bool compressed;
+
+    Entry(unique_ptr<char[], KeyDeleter> owned_key,
+          shared_ptr<string const> value, size_t const footprint,
+          bool const compressed = false)
+      : owned_key(move(owned_key)), value(move(value)), footprint(footprint),
+        compressed(compressed) {
+      key = string_view{this->owned_key.get(),
+                        this->owned_key.get_deleter().length};
+    }
+
+    // the value as it was put, a compressed one in a buffer of its own
+    shared_ptr<string const> plain() const {
+      return inflate(value, compressed);
+    }
+  };
+
+  // a compressed value decompressed, any other one as it is
+  static shared_ptr<string const> inflate(
+    shared_ptr<string const> const& value, bool const compressed) {
+    if (!compressed) {
+      return value;
+    }
+    return make_shared<string const>(Lz::decompress(*value).value());
+  }
+
  private:
-  unordered_map<string, string> table;
-  size_t size_in_bytes{0};
-  shared_mutex mutex;
+
+  using Table = unordered_map<string_view, Entry, hash<string_view>,
+                              equal_to<string_view>,
+                              SlabAllocator<pair<string_view const, Entry>>>;
+
+  // every shard sits on its own cache lines, so that their locks do not bounce
+  struct alignas(64) Shard {
+    shared_ptr<Slab> slab;
+    Table table;
+    size_t size_in_bytes{0};
+    size_t table_bytes{0};
+    size_t heap_bytes{0};
+    // only with Lookups::LockFree, updated under the write lock
+    unique_ptr<ConcurrentIndex> index;
+    shared_mutex mutex;
+  };
+
+  // chunks taken by a table node and by a shared value block
+  struct Layout {
+    size_t node;
+    size_t value;
+  };
+
+  size_t const number_of_shards;
+  Storage const storage;
+  Lookups const lookups;
+  unique_ptr<Shard[]> shards;
+
+  // measured once on a scratch slab, so that no library layout is assumed
+  static Layout const& layout() {
+    static Layout const layout = [] () -> Layout {
+      auto const probe = make_shared<Slab>();
+      Table table{SlabAllocator<Table::value_type>(probe)};
+      table.reserve(16);
+      size_t const before_node = probe->in_use();
+      table.try_emplace(string_view{}, nullptr, nullptr, 0);
+      size_t const node = probe->in_use() - before_node;
+      size_t const before_value = probe->in_use();
+      auto const value =
+        allocate_shared<string const>(SlabAllocator<string const>(probe));
+      return Layout{node, probe->in_use() - before_value};
+    }();
+    return layout;
+  }
+
+  // characters of a string that did not fit into the string itself
+  static size_t outside(string const& value) {
+    auto const object = reinterpret_cast<char const*>(&value);
+    bool const inside = !less<char const*>{}(value.data(), object) &&
+                        less<char const*>{}(value.data(), object + sizeof(value));
+    return inside ? 0 : value.capacity() + 1;
+  }
+
+  static size_t footprint(Shard const& shard, size_t const key_length,
+                          string const& value) {
+    if (shard.slab) {
+      return layout().node + Slab::chunk_size(key_length) +
+             layout().value + outside(value);
+    } else {
+      return key_length + value.length();
+    }
+  }
+
+  // the bucket array grows on inserts and is charged to the shard
+  static void account_table(Shard & shard) {
+    if (shard.slab) {
+      size_t const table_bytes = shard.table.bucket_count() > 1
+        ? Slab::chunk_size(shard.table.bucket_count() * sizeof(void*))
+        : 0;
+      shard.size_in_bytes += table_bytes;
+      shard.size_in_bytes -= shard.table_bytes;
+      shard.table_bytes = table_bytes;
+    }
+  }
+
+  static Entry const* find(Shard const& shard, string_view const key) {
+    auto const& it = shard.table.find(key);
+    if (it != shard.table.end()) {
+      return &it->second;
+    } else {
+      return nullptr;
+    }
+  }
+
+  static shared_ptr<string const> share(Shard const& shard,
+                                        string_view const key) {
+    Entry const* const entry = find(shard, key);
+    return entry != nullptr ? entry->plain() : nullptr;
+  }
 
  public:
-  explicit Cache() = default;
+  // keys are distributed over "number_of_shards" independently locked tables
+  explicit Cache(size_t const number_of_shards = 1,
+                 Storage const storage = Storage::Heap,
+                 Lookups const lookups = Lookups::Locked)
+    : number_of_shards(max<size_t>(number_of_shards, 1)),
+      storage(storage),
+      lookups(lookups),
+      shards(make_unique<Shard[]>(this->number_of_shards)) {
+    if (storage == Storage::Slab) {
+      for (size_t i = 0; i < this->number_of_shards; i++) {
+        shards[i].slab = make_shared<Slab>();
+        shards[i].table = Table{SlabAllocator<Table::value_type>(
+          shards[i].slab)};
+      }
+    }
+    if (lookups == Lookups::LockFree) {
+      for (size_t i = 0; i < this->number_of_shards; i++) {
+        shards[i].index = make_unique<ConcurrentIndex>();
+      }
+    }
+  }
   Cache(Cache const&) = delete;
   Cache(Cache &&) noexcept = delete;
   Cache &operator=(Cache const&) = delete;
   Cache &operator=(Cache &&) noexcept = delete;
 
+  // shared access to one shard for as long as the reader lives
+  class Reader final {
+   private:
+    Shard & shard;
+    shared_lock<shared_mutex> read_lock;
+
+   public:
+    explicit Reader(Shard & shard)
+      : shard(shard), read_lock(shard.mutex) {}
+
+    size_t size() const noexcept {
+      return shard.size_in_bytes;
+    }
+
+    // the entry stays put until the shard is write-locked
+    Entry const* find(string_view const key) const {
+      return Cache::find(shard, key);
+    }
+
+    // the value stays valid after it is overwritten, deleted or evicted
+    shared_ptr<string const> share(string_view const key) const {
+      return Cache::share(shard, key);
+    }
+
+    optional<string> get(string_view const key) const {
+      auto const value = Cache::share(shard, key);
+      if (value) {
+        return optional<string>{*value};
+      } else {
+        return nullopt;
+      }
+    }
+  };
+
+  /* exclusive access to one shard for as long as the writer lives, so that
+     a sequence of operations does not interleave with other threads */
+  class Writer final {
+   private:
+    Shard & shard;
+    unique_lock<shared_mutex> write_lock;
+
+   public:
+    explicit Writer(Shard & shard)
+      : shard(shard), write_lock(shard.mutex) {}
+
+    size_t size() const noexcept {
+      return shard.size_in_bytes;
+    }
+
+    bool empty() const {
+      return shard.table.empty();
+    }
+
+    /* size of the shard with nothing but an entry of "key" and "value", the
+       bucket array does not shrink when entries are evicted */
+    size_t size_of(string_view const key, string const& value) const {
+      return footprint(shard, key.length(), value) + shard.table_bytes;
+    }
+
+    // size of the shard once "key" holds "value"
+    size_t size_after(string_view const key, string const& value) const {
+      size_t const added = footprint(shard, key.length(), value);
+      auto const& it = shard.table.find(key);
+      if (it == shard.table.end()) {
+        return shard.size_in_bytes + added;
+      } else {
+        return shard.size_in_bytes - it->second.footprint + added;
+      }
+    }
+
+    // a value buffer taken from the shard's storage
+    shared_ptr<string const> make_value(string value) const {
+      if (shard.slab) {
+        return allocate_shared<string const>(
+          SlabAllocator<string const>(shard.slab), move(value));
+      } else {
+        return make_shared<string const>(move(value));
+      }
+    }
+
+    Entry const* find(string_view const key) const {
+      return Cache::find(shard, key);
+    }
+
+    shared_ptr<string const> share(string_view const key) const {
+      return Cache::share(shard, key);
+    }
+
+    optional<string> get(string_view const key) const {
+      auto const value = Cache::share(shard, key);
+      if (value) {
+        return optional<string>{*value};
+      } else {
+        return nullopt;
+      }
+    }
+
+    /* the entry holding "key" and whether it is new; an overwritten entry
+       keeps its place in the eviction order; a "compressed" value is
+       charged as it is */
+    pair<Entry const*, bool> put(string_view const key,
+                                 shared_ptr<string const> value,
+                                 bool const compressed = false) {
+      size_t const added = footprint(shard, key.length(), *value);
+      size_t const heap_bytes = outside(*value);
+      auto const it = shard.table.find(key);
+      if (it != shard.table.end()) {
+        shard.size_in_bytes -= it->second.footprint;
+        shard.size_in_bytes += added;
+        shard.heap_bytes -= outside(*it->second.value);
+        shard.heap_bytes += heap_bytes;
+        if (shard.index) {
+          shard.index->put(key, value, compressed);
+        }
+        it->second.value = move(value);
+        it->second.footprint = added;
+        it->second.compressed = compressed;
+        return {&it->second, false};
+      }
+      KeyDeleter const deleter{shard.slab.get(), key.length()};
+      unique_ptr<char[], KeyDeleter> owned_key{
+        shard.slab
+          ? static_cast<char*>(shard.slab->allocate(key.length()))
+          : new char[key.length()],
+        deleter};
+      key.copy(owned_key.get(), key.length());
+      if (shard.index) {
+        shard.index->put(key, value, compressed);
+      }
+      string_view const view{owned_key.get(), key.length()};
+      auto const inserted = shard.table.try_emplace(
+        view, move(owned_key), move(value), added, compressed).first;
+      shard.size_in_bytes += added;
+      shard.heap_bytes += heap_bytes;
+      account_table(shard);
+      return {&inserted->second, true};
+    }
+
+    // removes the entry and hands its value over to the caller, as stored
+    shared_ptr<string const> take(string_view const key) {
+      auto const& it = shard.table.find(key);
+      if (it != shard.table.end()) {
+        shard.size_in_bytes -= it->second.footprint;
+        shard.heap_bytes -= outside(*it->second.value);
+        shared_ptr<string const> value{move(it->second.value)};
+        shard.table.erase(it);
+        if (shard.index) {
+          shard.index->erase(key);
+        }
+        return value;
+      }
+      return nullptr;
+    }
+  };
+
+  size_t shard(string_view const key) const {
+    return number_of_shards == 1
+      ? 0
+      : hash<string_view>{}(key) % number_of_shards;
+  }
+
+  size_t shard_count() const noexcept {
+    return number_of_shards;
+  }
+
+  Reader read(size_t const shard) {
+    return Reader(shards[shard]);
+  }
+
+  Writer write(size_t const shard) {
+    return Writer(shards[shard]);
+  }
+
   size_t size() {
-    shared_lock<shared_mutex> read_lock(mutex);
+    size_t size_in_bytes{0};
+    for (size_t i = 0; i < number_of_shards; i++) {
+      size_in_bytes += size(i);
+    }
     return size_in_bytes;
   }
 
-  size_t incoming_size_change(string const& key, string const& value) {
-    shared_lock<shared_mutex> read_lock(mutex);
-    auto const& it = table.find(key);
-    if (it == table.begin() || it == table.end()) {;
-      return key.length() + value.length();
-    } else {
-      return value.length() - it->second.length();
+  size_t size(size_t const shard) {
+    return read(shard).size();
+  }
+
+  /* bytes the allocator reports for the entries: with Storage::Slab the
+     chunks in use plus value characters kept outside the slabs, which
+     includes values still shared after they left the cache */
+  size_t allocated() {
+    if (storage == Storage::Heap) {
+      return size();
+    }
+    size_t bytes{0};
+    for (size_t i = 0; i < number_of_shards; i++) {
+      shared_lock<shared_mutex> read_lock(shards[i].mutex);
+      bytes += shards[i].slab->in_use() + shards[i].heap_bytes;
     }
+    return bytes;
   }
 
-  bool put(string const& key, string const& value) {
-    unique_lock<shared_mutex> write_lock(mutex);
-    auto const& [it, res] = table.try_emplace(key, value);
-    if (res) {
-      size_in_bytes += key.length() + value.length();
-    } else {
-      size_in_bytes += value.length() - it->second.length();
-      it->second = value;
+  bool put(string_view const key, string value) {
+    Writer writer = write(shard(key));
+    return writer.put(key, writer.make_value(move(value))).second;
+  }
+
+  optional<string> get(string_view const key) {
+    if (lookups == Lookups::LockFree) {
+      optional<string> value;
+      get_with(key, [&value] (string_view const found) -> void {
+        value.emplace(found);
+      });
+      return value;
     }
-    return res;
+    return read(shard(key)).get(key);
   }
 
-  optional<string> get(string const& key) {
-    shared_lock<shared_mutex> read_lock(mutex);
-    auto const& it = table.find(key);
-    if (it != table.end()) {
-      return optional<string>{it->second};
-    } else {
-      return nullopt;
+  // with Lookups::LockFree the copy of the pointer is the only shared write
+  shared_ptr<string const> share(string_view const key) {
+    if (lookups == Lookups::LockFree) {
+      Epoch::Guard const guard;
+      shared_ptr<string const> value;
+      bool compressed{false};
+      shards[shard(key)].index->visit(key,
+        [&value, &compressed] (shared_ptr<string const> const& found,
+                               bool const found_compressed) -> void {
+          value = found;
+          compressed = found_compressed;
+        });
+      if (!compressed) {
+        return value;
+      }
+      return inflate(value, compressed);
     }
+    return read(shard(key)).share(key);
   }
 
-  bool del(string const& key) {
-    unique_lock<shared_mutex> write_lock(mutex);
-    auto const& it = table.find(key);
-    if (it != table.end()) {
-      size_in_bytes -= it->first.length() + it->second.length();
-      table.erase(it);
+  /* runs "visitor" on the value in place, the shard is read-locked or the
+     epoch pinned meanwhile */
+  template<typename Visitor>
+  bool get_with(string_view const key, Visitor && visitor) {
+    if (lookups == Lookups::LockFree) {
+      Epoch::Guard const guard;
+      return shards[shard(key)].index->visit(key,
+        [&visitor] (shared_ptr<string const> const& found,
+                    bool const compressed) -> void {
+          // no reference count is touched unless the value is compressed
+          if (!compressed) {
+            visitor(string_view{*found});
+          } else {
+            visitor(string_view{*inflate(found, compressed)});
+          }
+        });
+    }
+    Reader const reader = read(shard(key));
+    auto const value = reader.share(key);
+    if (value) {
+      visitor(string_view{*value});
       return true;
     }
     return false;
   }
 
+  bool del(string_view const key) {
+    return write(shard(key)).take(key) != nullptr;
+  }
+
   // used for interactive demonstration
   void delAll() {
-    unique_lock<shared_mutex> write_lock(mutex);
-    table.clear();
-    size_in_bytes = 0;
+    for (size_t i = 0; i < number_of_shards; i++) {
+      unique_lock<shared_mutex> write_lock(shards[i].mutex);
+      shards[i].table.clear();
+      if (shards[i].index) {
+        shards[i].index->clear();
+      }
+      shards[i].size_in_bytes = shards[i].table_bytes;
+      shards[i].heap_bytes = 0;
+    }
   }
 
   // used for interactive demonstration
   void printAll() {
-    shared_lock<shared_mutex> read_lock(mutex);
-    if (table.empty()) {
-      cout << "Cache is empty" << endl;
-    } else {
-      for (auto const& [key, val] : table) {
-        cout << key << ':' << val << endl;
+    bool empty{true};
+    for (size_t i = 0; i < number_of_shards; i++) {
+      shared_lock<shared_mutex> read_lock(shards[i].mutex);
+      for (auto const& [key, entry] : shards[i].table) {
+        cout << key << ':' << *entry.plain() << endl;
+        empty = false;
       }
     }
+    if (empty) {
+      cout << "Cache is empty" << endl;
+    }
   }
 };
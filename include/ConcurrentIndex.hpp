@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <Epoch.hpp>
+
+using namespace std;
+
+/* hash index from keys to shared values whose lookups take no locks and
+   write nothing shared: nodes are never modified once published, an
+   overwrite links a new node in place of the old one, and unlinked nodes
+   and outgrown tables are retired to the epoch domain; writers have to be
+   serialized by the caller */
+class ConcurrentIndex final {
+ private:
+  struct Node {
+    size_t hash;
+    string key;
+    shared_ptr<string const> value;
+    bool compressed;
+    atomic<Node*> next;
+
+    Node(size_t const hash, string_view const key,
+         shared_ptr<string const> value, bool const compressed,
+         Node* const next)
+      : hash(hash), key(key), value(move(value)), compressed(compressed),
+        next(next) {}
+  };
+
+  // owns the nodes linked into its buckets
+  struct Table {
+    size_t const number_of_buckets;
+    unique_ptr<atomic<Node*>[]> buckets;
+
+    explicit Table(size_t const number_of_buckets)
+      : number_of_buckets(number_of_buckets),
+        buckets(make_unique<atomic<Node*>[]>(number_of_buckets)) {
+      for (size_t i = 0; i < number_of_buckets; i++) {
+        buckets[i].store(nullptr, memory_order_relaxed);
+      }
+    }
+    ~Table() {
+      for (size_t i = 0; i < number_of_buckets; i++) {
+        Node* node = buckets[i].load(memory_order_relaxed);
+        while (node != nullptr) {
+          Node* const next = node->next.load(memory_order_relaxed);
+          delete node;
+          node = next;
+        }
+      }
+    }
+
+    atomic<Node*> & bucket(size_t const hash) const {
+      return buckets[hash & (number_of_buckets - 1)];
+    }
+  };
+
+  atomic<Table*> table;
+  size_t number_of_nodes{0};
+
+  // the link pointing to the node of "key", or to the end of its bucket
+  static atomic<Node*> & link(Table const& table, size_t const hash,
+                              string_view const key) {
+    atomic<Node*> * link = &table.bucket(hash);
+    for (Node* node = link->load(memory_order_relaxed); node != nullptr;
+         node = node->next.load(memory_order_relaxed)) {
+      if (node->hash == hash && node->key == key) {
+        break;
+      }
+      link = &node->next;
+    }
+    return *link;
+  }
+
+  // copies every node into a table twice as large
+  void grow() {
+    Table* const old_table = table.load(memory_order_relaxed);
+    Table* const new_table = new Table(old_table->number_of_buckets * 2);
+    for (size_t i = 0; i < old_table->number_of_buckets; i++) {
+      for (Node* node = old_table->buckets[i].load(memory_order_relaxed);
+           node != nullptr; node = node->next.load(memory_order_relaxed)) {
+        atomic<Node*> & bucket = new_table->bucket(node->hash);
+        bucket.store(new Node(node->hash, node->key, node->value,
+                              node->compressed,
+                              bucket.load(memory_order_relaxed)),
+                     memory_order_relaxed);
+      }
+    }
+    table.store(new_table, memory_order_release);
+    Epoch::domain().retire(old_table);
+  }
+
+ public:
+  // "number_of_buckets" is rounded up to a power of two
+  explicit ConcurrentIndex(size_t const number_of_buckets = 16) {
+    size_t buckets{1};
+    while (buckets < number_of_buckets) {
+      buckets *= 2;
+    }
+    table.store(new Table(buckets), memory_order_relaxed);
+  }
+  // no reader may be left
+  ~ConcurrentIndex() {
+    delete table.load(memory_order_relaxed);
+  }
+  ConcurrentIndex(ConcurrentIndex const&) = delete;
+  ConcurrentIndex(ConcurrentIndex &&) noexcept = delete;
+  ConcurrentIndex &operator=(ConcurrentIndex const&) = delete;
+  ConcurrentIndex &operator=(ConcurrentIndex &&) noexcept = delete;
+
+  /* runs "visitor(value, compressed)" on the value of "key"; the caller has
+     to hold an Epoch::Guard for as long as it uses the value, created before
+     this is called, whose fence keeps the loads below after the pin */
+  template<typename Visitor>
+  bool visit(string_view const key, Visitor && visitor) const {
+    size_t const hash = std::hash<string_view>{}(key);
+    Table const* const current = table.load(memory_order_acquire);
+    for (Node const* node = current->bucket(hash).load(memory_order_acquire);
+         node != nullptr; node = node->next.load(memory_order_acquire)) {
+      if (node->hash == hash && node->key == key) {
+        visitor(node->value, node->compressed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // "compressed" is kept along for the readers
+  void put(string_view const key, shared_ptr<string const> value,
+           bool const compressed = false) {
+    size_t const hash = std::hash<string_view>{}(key);
+    atomic<Node*> & found = link(*table.load(memory_order_relaxed), hash, key);
+    Node* const old_node = found.load(memory_order_relaxed);
+    if (old_node != nullptr) {
+      found.store(new Node(hash, key, move(value), compressed,
+                           old_node->next.load(memory_order_relaxed)),
+                  memory_order_release);
+      Epoch::domain().retire(old_node);
+      return;
+    }
+    Table* const current = table.load(memory_order_relaxed);
+    atomic<Node*> & bucket = current->bucket(hash);
+    bucket.store(new Node(hash, key, move(value), compressed,
+                          bucket.load(memory_order_relaxed)),
+                 memory_order_release);
+    if (++number_of_nodes > current->number_of_buckets) {
+      grow();
+    }
+  }
+
+  bool erase(string_view const key) {
+    size_t const hash = std::hash<string_view>{}(key);
+    atomic<Node*> & found = link(*table.load(memory_order_relaxed), hash, key);
+    Node* const node = found.load(memory_order_relaxed);
+    if (node == nullptr) {
+      return false;
+    }
+    found.store(node->next.load(memory_order_relaxed), memory_order_release);
+    Epoch::domain().retire(node);
+    --number_of_nodes;
+    return true;
+  }
+
+  void clear() {
+    Table* const old_table = table.load(memory_order_relaxed);
+    table.store(new Table(old_table->number_of_buckets),
+                memory_order_release);
+    Epoch::domain().retire(old_table);
+    number_of_nodes = 0;
+  }
+};
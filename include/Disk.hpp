@@ -1,119 +1,1198 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <BlockCache.hpp>
+#include <Filter.hpp>
+#include <Lz.hpp>
+#include <Record.hpp>
 
 using namespace std;
 
 class Disk final {
+ public:
+  // how get() reaches the bytes of a value
+  enum class Reads { Streamed, Mapped };
+
+  /* whether the files outlive the disk: "Temporary" removes them on
+     destruction, "Persistent" leaves them to be reopened and replayed */
+  enum class Lifetime { Temporary, Persistent };
+
+  /* "Blocks" rewrites every sealed segment as compressed blocks of records
+     in the background, the active segment is always left uncompressed */
+  enum class Compression { None, Blocks };
+
+  static constexpr double default_compaction_ratio{0.5};
+  static constexpr size_t default_segment_bytes{4 << 20};
+
+  // a value read in place, "pin" keeps the memory behind "value" alive
+  struct View {
+    shared_ptr<void const> pin;
+    string_view value;
+  };
+
+  // state of the filter answering lookups of keys that are not on the disk
+  struct FilterStats {
+    size_t keys;
+    size_t bytes;
+    // expected for the current load
+    double false_positive_rate;
+    // lookups answered by the filter alone
+    uint64_t negatives;
+    // lookups that passed the filter and missed the index
+    uint64_t false_positives;
+  };
+
  private:
+  // every key line of the legacy text format starts with the record's kind
+  static constexpr char legacy_value{'+'};
+  static constexpr char legacy_tombstone{'-'};
+  static constexpr char index_magic[8] = {'K', 'V', 'I', 'D', 'X', '3',
+                                          '\n', '\0'};
+  // uncompressed bytes of records gathered into one block
+  static constexpr size_t block_bytes{4 << 10};
+  static constexpr size_t cached_block_bytes{8 << 20};
+
+  /* position of the latest value recorded under a key; in a compressed
+     block "offset" is that of the block, "block" its compressed length and
+     "within" the offset of the value in the decompressed block */
+  struct Location {
+    size_t segment;
+    streamoff offset;
+    size_t length;
+    uint32_t block{0};
+    uint32_t within{0};
+
+    bool operator==(Location const& other) const {
+      return segment == other.segment && offset == other.offset &&
+             within == other.within;
+    }
+  };
+
+  /* segments are append-only files, only the last one is appended to;
+     "size_bytes" and "dead" count records uncompressed, "packed_bytes" is
+     the size of a segment rewritten as compressed blocks */
+  struct Segment {
+    streamoff size_bytes{0};
+    streamoff dead{0};
+    streamoff packed_bytes{0};
+
+    streamoff size() const {
+      return packed_bytes > 0 ? packed_bytes : size_bytes;
+    }
+  };
+
+  // read-only mapping of a segment, unmapped once the last reader is done
+  struct Mapping {
+    void* address{MAP_FAILED};
+    size_t length{0};
+
+    explicit Mapping(string const& filename) {
+      int const fd = ::open(filename.c_str(), O_RDONLY);
+      struct stat status;
+      if (fd < 0 || fstat(fd, &status) != 0) {
+        if (fd >= 0) {
+          ::close(fd);
+        }
+        throw ios::failure("Error mapping data from file");
+      }
+      length = static_cast<size_t>(status.st_size);
+      if (length > 0) {
+        address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+      }
+      ::close(fd);
+      if (length > 0 && address == MAP_FAILED) {
+        throw ios::failure("Error mapping data from file");
+      }
+    }
+    ~Mapping() {
+      if (address != MAP_FAILED) {
+        munmap(address, length);
+      }
+    }
+    Mapping(Mapping const&) = delete;
+    Mapping &operator=(Mapping const&) = delete;
+  };
+
+  // what one worker found in a segment, from where the replay started on
+  struct Scan {
+    Segment part;
+    // the latest record of every key, nullopt for a tombstone
+    unordered_map<string, optional<Location>> latest;
+    // the segment ends in a torn or corrupt record, right after "part"
+    bool torn{false};
+  };
+
+  string const filename_records{"Storage_records"};
+  // the pairs of text files segments were stored in before
   string const filename_keys{"Storage_keys"};
   string const filename_values{"Storage_values"};
+  string const filename_index{"Storage_index"};
+  double const compaction_ratio;
+  streamoff const segment_bytes;
+  Reads const reads;
+  Lifetime const lifetime;
+  size_t const checkpoint_bytes;
+  Compression const compression;
+  // bytes a replay would have to read past the last checkpoint
+  atomic<size_t> appended{0};
+
+  unordered_map<string, Location> index;
+  // every key of "index", grown along with it
+  CountingFilter filter;
+  atomic<uint64_t> filter_negatives{0};
+  atomic<uint64_t> filter_false_positives{0};
+  map<size_t, Segment> segments;
+  size_t active{0};
+  size_t generation{0};
+  ofstream stream_records;
   shared_mutex mutex;
 
+  /* mappings are replaced when the file grew past them and dropped when the
+     file is rewritten, readers holding the previous one keep it alive */
+  unordered_map<size_t, shared_ptr<Mapping const>> mappings;
+  std::mutex mappings_mutex;
+  BlockCache block_cache{cached_block_bytes};
+
+  // serializes compaction passes and checkpoints, in the background or not
+  std::mutex compaction_mutex;
+  std::mutex compactor_mutex;
+  condition_variable compactor_wakeup;
+  bool compactor_pending{false};
+  bool compactor_stopping{false};
+  thread compactor;
+
+  static streamoff record_size(string const& key, size_t const length) {
+    return static_cast<streamoff>(RecordHeader::size + key.length() + length);
+  }
+
+  string segment_records(size_t const segment) const {
+    return filename_records + '.' + to_string(segment);
+  }
+  string segment_keys(size_t const segment) const {
+    return filename_keys + '.' + to_string(segment);
+  }
+  string segment_values(size_t const segment) const {
+    return filename_values + '.' + to_string(segment);
+  }
+
+  void open() {
+    stream_records.open(segment_records(active), ios::app | ios::binary);
+    if (stream_records.fail()) {
+      throw ios::failure("Error opening storage files");
+    }
+    segments.try_emplace(active);
+  }
+
+  void close() {
+    stream_records.close();
+  }
+
+  /* reads the record at "position" and moves past it; false at the end of
+     the segment and at a torn or corrupt record, which is left unread */
+  static bool read_record(istream & stream, streamoff & position,
+                          streamoff const end, RecordHeader & header,
+                          string & key, string & value) {
+    char bytes[RecordHeader::size];
+    if (end - position < static_cast<streamoff>(sizeof(bytes)) ||
+        !stream.read(bytes, sizeof(bytes))) {
+      return false;
+    }
+    header = RecordHeader::decode(bytes);
+    streamoff const length = static_cast<streamoff>(sizeof(bytes)) +
+                             header.key_length + header.value_length;
+    if (end - position < length) {
+      return false;
+    }
+    key.resize(header.key_length);
+    value.resize(header.value_length);
+    if (!stream.read(key.data(), static_cast<streamsize>(key.length())) ||
+        !stream.read(value.data(), static_cast<streamsize>(value.length())) ||
+        header.sum(key, value) != header.checksum) {
+      return false;
+    }
+    position += length;
+    return true;
+  }
+
+  static void write_record(ostream & stream, uint8_t const flags,
+                           string_view const key, string_view const value) {
+    auto const header = RecordHeader::of(flags, key, value).encode();
+    stream.write(header.data(), static_cast<streamsize>(header.size()));
+    stream.write(key.data(), static_cast<streamsize>(key.length()));
+    stream.write(value.data(), static_cast<streamsize>(value.length()));
+  }
+
+  /* runs "visitor(header, key, value, location)" on every record from
+     "position" on, the records of compressed blocks included; stops at a
+     torn or corrupt record, "position" is left right after the last intact
+     one */
+  template<typename Visitor>
+  static void for_each_record(istream & stream, size_t const segment,
+                              streamoff & position, streamoff const end,
+                              Visitor && visitor) {
+    RecordHeader header;
+    string key, value;
+    while (read_record(stream, position, end, header, key, value)) {
+      streamoff const offset = position - static_cast<streamoff>(
+                                 value.length());
+      if (!(header.flags & RecordHeader::block)) {
+        visitor(header, key, value, Location{segment, offset, value.length()});
+        continue;
+      }
+      optional<string> const block = Lz::decompress(value);
+      if (!block.has_value()) {
+        throw ios::failure("Error decompressing data");
+      }
+      istringstream stream_block(*block);
+      streamoff const block_end = static_cast<streamoff>(block->length());
+      streamoff within{0};
+      RecordHeader inner_header;
+      string inner_key, inner_value;
+      while (read_record(stream_block, within, block_end, inner_header,
+                         inner_key, inner_value)) {
+        visitor(inner_header, inner_key, inner_value,
+                Location{segment, offset, inner_value.length(),
+                         static_cast<uint32_t>(value.length()),
+                         static_cast<uint32_t>(within - static_cast<streamoff>(
+                           inner_value.length()))});
+      }
+      if (within != block_end) {
+        throw ios::failure("Error decompressing data");
+      }
+    }
+  }
+
+  /* rewrites the segments left in the legacy text format, pairs of files
+     read in lockstep line by line, as binary records; an interrupted
+     migration is repeated, the text files are removed only at its end */
+  void migrate() {
+    bool migrated{false};
+    for (auto const& entry : filesystem::directory_iterator(".")) {
+      string const name = entry.path().filename().string();
+      if (name.rfind(filename_keys + '.', 0) != 0) {
+        continue;
+      }
+      string const suffix = name.substr(filename_keys.length()+1);
+      if (suffix.empty() ||
+          suffix.find_first_not_of("0123456789") != string::npos) {
+        continue;
+      }
+      size_t const segment = stoul(suffix);
+      string const temp{segment_records(segment) + ".migrate"};
+      {
+        ifstream stream_keys_in(segment_keys(segment)),
+                 stream_values_in(segment_values(segment));
+        ofstream stream_out(temp, ios::binary | ios::trunc);
+        if (stream_keys_in.fail() || stream_values_in.fail() ||
+            stream_out.fail()) {
+          throw ios::failure("Error migrating data");
+        }
+        string string_key, string_value;
+        while (getline(stream_keys_in, string_key) &&
+               getline(stream_values_in, string_value)) {
+          write_record(stream_out,
+                       string_key.front() == legacy_tombstone
+                         ? RecordHeader::tombstone : 0,
+                       string_view{string_key}.substr(1), string_value);
+        }
+        stream_out.close();
+        if (stream_out.fail()) {
+          throw ios::failure("Error migrating data");
+        }
+      }
+      rename(temp.c_str(), segment_records(segment).c_str());
+      remove(segment_keys(segment).c_str());
+      remove(segment_values(segment).c_str());
+      migrated = true;
+    }
+    // a checkpoint can only have described the text files
+    if (migrated) {
+      remove(filename_index.c_str());
+    }
+  }
+
+  shared_ptr<Mapping const> map_segment(size_t const segment, size_t const end) {
+    lock_guard<std::mutex> lock(mappings_mutex);
+    auto & mapping = mappings[segment];
+    if (!mapping || mapping->length < end) {
+      mapping = make_shared<Mapping const>(segment_records(segment));
+      if (mapping->length < end) {
+        throw ios::failure("Error getting data from file");
+      }
+    }
+    return mapping;
+  }
+
+  // the segment was rewritten, its mapping and blocks are stale
+  void unmap_segment(size_t const segment) {
+    {
+      lock_guard<std::mutex> lock(mappings_mutex);
+      mappings.erase(segment);
+    }
+    block_cache.drop(segment);
+  }
+
+  static void write_number(ostream & stream, uint64_t const number) {
+    stream.write(reinterpret_cast<char const*>(&number), sizeof(number));
+  }
+
+  static uint64_t read_number(istream & stream) {
+    uint64_t number{0};
+    stream.read(reinterpret_cast<char*>(&number), sizeof(number));
+    return number;
+  }
+
+  static streamoff file_size(string const& filename) {
+    error_code error;
+    auto const size = filesystem::file_size(filename, error);
+    return error ? -1 : static_cast<streamoff>(size);
+  }
+
+  /* loads the last checkpoint if it still describes the files: a segment
+     sealed since may only have grown at its end, any other segment must be
+     untouched, which compaction guarantees by removing the checkpoint */
+  void load_index() {
+    ifstream stream(filename_index, ios::binary);
+    char magic[sizeof(index_magic)];
+    if (stream.fail() || !stream.read(magic, sizeof(magic)) ||
+        !equal(begin(magic), end(magic), begin(index_magic))) {
+      return;
+    }
+    map<size_t, Segment> checkpointed;
+    for (uint64_t count = read_number(stream); stream && count > 0; count--) {
+      size_t const segment = read_number(stream);
+      Segment & state = checkpointed[segment];
+      state.size_bytes = static_cast<streamoff>(read_number(stream));
+      state.dead = static_cast<streamoff>(read_number(stream));
+      state.packed_bytes = static_cast<streamoff>(read_number(stream));
+    }
+    if (!stream || checkpointed.empty()) {
+      return;
+    }
+    // a segment the checkpoint does not know has to be newer than it
+    for (auto const& [segment, state] : segments) {
+      if (segment < checkpointed.rbegin()->first &&
+          checkpointed.count(segment) == 0) {
+        return;
+      }
+    }
+    for (auto const& [segment, state] : checkpointed) {
+      bool const last = segment == checkpointed.rbegin()->first;
+      streamoff const size_bytes = file_size(segment_records(segment));
+      if (segments.count(segment) == 0 || size_bytes < state.size() ||
+          (!last && size_bytes != state.size())) {
+        return;
+      }
+    }
+    vector<pair<string, Location>> entries(read_number(stream));
+    for (auto & [key, location] : entries) {
+      key.resize(read_number(stream));
+      stream.read(key.data(), static_cast<streamsize>(key.length()));
+      location.segment = read_number(stream);
+      location.offset = static_cast<streamoff>(read_number(stream));
+      location.length = read_number(stream);
+      location.block = static_cast<uint32_t>(read_number(stream));
+      location.within = static_cast<uint32_t>(read_number(stream));
+    }
+    if (!stream) {
+      return;
+    }
+    for (auto const& [segment, state] : checkpointed) {
+      segments[segment] = state;
+    }
+    // sized once instead of growing step by step
+    index.reserve(entries.size());
+    filter.rebuild(max(entries.size(), filter.capacity()), index);
+    for (auto const& [key, location] : entries) {
+      place(key, location);
+    }
+  }
+
+  // reads the records of a segment that follow the part "from" covers
+  Scan replay(size_t const segment, Segment const& from) const {
+    Scan scan;
+    ifstream stream(segment_records(segment), ios::binary);
+    streamoff const end = file_size(segment_records(segment));
+    if (stream.fail() || end < 0 || !stream.seekg(from.size())) {
+      throw ios::failure("Error getting data from file");
+    }
+    streamoff position = from.size();
+    bool packed{false};
+    for_each_record(stream, segment, position, end,
+                    [&] (RecordHeader const& header, string const& key,
+                         string const& value, Location const& location)
+                      -> void {
+      auto & latest = scan.latest[key];
+      if (latest.has_value()) {
+        scan.part.dead += record_size(key, latest->length);
+      }
+      scan.part.size_bytes += record_size(key, value.length());
+      packed = packed || location.block > 0;
+      if (header.flags & RecordHeader::tombstone) {
+        latest.reset();
+        scan.part.dead += record_size(key, value.length());
+      } else {
+        latest = location;
+      }
+    });
+    if (packed) {
+      scan.part.packed_bytes = position - from.size();
+    }
+    scan.torn = position != end;
+    return scan;
+  }
+
+  /* loads the last checkpoint and replays what was appended after it: one
+     worker per segment finds the latest record of every key, and the
+     results are applied in segment order, so that later segments win */
+  void rebuild() {
+    // files a compaction or a migration was writing when the process ended
+    vector<filesystem::path> leftovers;
+    for (auto const& entry : filesystem::directory_iterator(".")) {
+      auto const& path = entry.path();
+      if (path.filename().string().rfind(filename_records + '.', 0) == 0 &&
+          (path.extension() == ".compact" || path.extension() == ".migrate")) {
+        leftovers.push_back(path);
+      }
+    }
+    for (auto const& path : leftovers) {
+      filesystem::remove(path);
+    }
+    migrate();
+    for (auto const& entry : filesystem::directory_iterator(".")) {
+      string const name = entry.path().filename().string();
+      if (name.rfind(filename_records + '.', 0) == 0) {
+        string const suffix = name.substr(filename_records.length()+1);
+        if (!suffix.empty() &&
+            suffix.find_first_not_of("0123456789") == string::npos) {
+          segments.try_emplace(stoul(suffix));
+        }
+      }
+    }
+    load_index();
+    vector<pair<size_t, Segment>> const parts(segments.begin(),
+                                              segments.end());
+    vector<Scan> scans(parts.size());
+    vector<exception_ptr> errors(parts.size());
+    atomic<size_t> next{0};
+    auto const worker = [&] () -> void {
+      for (size_t i = next++; i < parts.size(); i = next++) {
+        try {
+          scans[i] = replay(parts[i].first, parts[i].second);
+        } catch (...) {
+          errors[i] = current_exception();
+        }
+      }
+    };
+    vector<thread> workers;
+    size_t const number_of_workers = min<size_t>(
+      parts.size(), max<unsigned>(thread::hardware_concurrency(), 1));
+    for (size_t i = 1; i < number_of_workers; i++) {
+      workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & thread : workers) {
+      thread.join();
+    }
+    for (size_t i = 0; i < parts.size(); i++) {
+      if (errors[i]) {
+        rethrow_exception(errors[i]);
+      }
+      /* only the last segment is appended to, so only it can end in a write
+         torn by a crash; a sealed one is damaged, and left as it is */
+      if (scans[i].torn && i + 1 < parts.size()) {
+        throw ios::failure("Corrupt record in sealed segment " +
+                           to_string(parts[i].first));
+      }
+    }
+    for (size_t i = 0; i < parts.size(); i++) {
+      Segment & state = segments[parts[i].first];
+      state.size_bytes += scans[i].part.size_bytes;
+      state.dead += scans[i].part.dead;
+      state.packed_bytes += scans[i].part.packed_bytes;
+      // appends continue right after the last intact record
+      if (scans[i].torn) {
+        filesystem::resize_file(segment_records(parts[i].first),
+                                static_cast<uintmax_t>(state.size()));
+      }
+      appended += static_cast<size_t>(scans[i].part.size());
+      for (auto const& [key, latest] : scans[i].latest) {
+        supersede(key);
+        if (latest.has_value()) {
+          place(key, *latest);
+        } else {
+          unplace(key);
+        }
+      }
+      active = parts[i].first;
+    }
+  }
+
+  // the disk has to be locked, at least for reading
+  void write_index() {
+    string const temp{filename_index + ".tmp"};
+    ofstream stream(temp, ios::binary | ios::trunc);
+    stream.write(index_magic, sizeof(index_magic));
+    write_number(stream, segments.size());
+    for (auto const& [segment, state] : segments) {
+      write_number(stream, segment);
+      write_number(stream, static_cast<uint64_t>(state.size_bytes));
+      write_number(stream, static_cast<uint64_t>(state.dead));
+      write_number(stream, static_cast<uint64_t>(state.packed_bytes));
+    }
+    write_number(stream, index.size());
+    for (auto const& [key, location] : index) {
+      write_number(stream, key.length());
+      stream.write(key.data(), static_cast<streamsize>(key.length()));
+      write_number(stream, location.segment);
+      write_number(stream, static_cast<uint64_t>(location.offset));
+      write_number(stream, location.length);
+      write_number(stream, location.block);
+      write_number(stream, location.within);
+    }
+    stream.close();
+    if (stream.fail()) {
+      remove(temp.c_str());
+      throw ios::failure("Error writing index checkpoint");
+    }
+    rename(temp.c_str(), filename_index.c_str());
+    appended = 0;
+  }
+
+  // accounts the current record of a key as dead bytes of its segment
+  void supersede(string const& key) {
+    auto const it = index.find(key);
+    if (it != index.end()) {
+      auto const segment = segments.find(it->second.segment);
+      segment->second.dead += record_size(key, it->second.length);
+      if (segment->first != active) {
+        wake_compactor(segment->second);
+      }
+    }
+  }
+
+  // indexes the latest record of a key
+  void place(string const& key, Location const& location) {
+    if (index.insert_or_assign(key, location).second) {
+      filter.add(key);
+      if (filter.size() > filter.capacity()) {
+        filter.rebuild(filter.capacity() * 2, index);
+      }
+    }
+  }
+
+  void unplace(string const& key) {
+    if (index.erase(key) > 0) {
+      filter.remove(key);
+    }
+  }
+
+  // buffered like append()
+  bool erase(string const& key) {
+    if (index.find(key) == index.end()) {
+      return false;
+    }
+    append(RecordHeader::tombstone, key, "");
+    supersede(key);
+    unplace(key);
+    segments[active].dead += record_size(key, 0);
+    roll();
+    return true;
+  }
+
+  static string const& bytes(string const& value) {
+    return value;
+  }
+  static string const& bytes(shared_ptr<string const> const& value) {
+    return *value;
+  }
+
+  /* buffered, records become visible to readers once flushed; returns the
+     offset of the value in the active segment */
+  streamoff append(uint8_t const flags, string const& key,
+                   string const& value) {
+    write_record(stream_records, flags, key, value);
+    auto & segment = segments[active];
+    segment.size_bytes += record_size(key, value.length());
+    appended += static_cast<size_t>(record_size(key, value.length()));
+    return segment.size_bytes - static_cast<streamoff>(value.length());
+  }
+
+  void flush() {
+    stream_records.flush();
+    if (stream_records.fail()) {
+      throw ios::failure("Error putting data into file");
+    }
+  }
+
+  // seals the active segment once it is full and starts the next one
+  void roll() {
+    auto & segment = segments[active];
+    if (segment.size() >= segment_bytes) {
+      flush();
+      close();
+      ++active;
+      open();
+      wake_compactor(segment);
+    }
+    if (checkpoint_due()) {
+      wake();
+    }
+  }
+
+  bool checkpoint_due() const {
+    return checkpoint_bytes > 0 && appended >= checkpoint_bytes;
+  }
+
+  // over the threshold, or still to be compressed or decompressed
+  bool compactable(Segment const& segment) const {
+    return segment.size_bytes > 0 &&
+           ((compression == Compression::Blocks) ==
+              (segment.packed_bytes == 0) ||
+            static_cast<double>(segment.dead) >
+              compaction_ratio * static_cast<double>(segment.size_bytes));
+  }
+
+  void wake_compactor(Segment const& segment) {
+    if (compactable(segment)) {
+      wake();
+    }
+  }
+
+  void wake() {
+    {
+      lock_guard<std::mutex> lock(compactor_mutex);
+      compactor_pending = true;
+    }
+    compactor_wakeup.notify_one();
+  }
+
+  void run_compactor() {
+    while (true) {
+      {
+        unique_lock<std::mutex> lock(compactor_mutex);
+        compactor_wakeup.wait(lock, [this] () -> bool {
+          return compactor_pending || compactor_stopping;
+        });
+        if (compactor_stopping) {
+          return;
+        }
+        compactor_pending = false;
+      }
+      try {
+        compact();
+        if (checkpoint_due()) {
+          checkpoint();
+        }
+      } catch (ios::failure const&) {
+        // the segment is left as it is and retried on the next wakeup
+      }
+    }
+  }
+
+  /* copies the live records of a sealed segment into a new file, then swaps
+     it in under the exclusive lock; the disk is read-locked only to look the
+     segment's records up in the index, not while they are read and written,
+     so puts and deletes go on meanwhile; with compression the records are
+     gathered into compressed blocks */
+  void compact(size_t const segment) {
+    struct Moved {
+      string key;
+      Location from;
+      Location to;
+    };
+    size_t generation_copied;
+    streamoff end;
+    {
+      shared_lock<shared_mutex> read_lock(mutex);
+      if (segment == active || segments.count(segment) == 0) {
+        return;
+      }
+      generation_copied = generation;
+      end = segments[segment].size();
+    }
+    // a sealed segment is only rewritten here, it can be read unlocked
+    struct Scanned {
+      string key;
+      Location location;
+      bool tombstone;
+    };
+    vector<Scanned> scanned;
+    {
+      ifstream stream_in(segment_records(segment), ios::binary);
+      if (stream_in.fail()) {
+        throw ios::failure("Error compacting data");
+      }
+      streamoff position{0};
+      for_each_record(stream_in, segment, position, end,
+                      [&scanned] (RecordHeader const& header,
+                                  string const& key, string const&,
+                                  Location const& location) -> void {
+        scanned.push_back({key, location,
+                           (header.flags & RecordHeader::tombstone) != 0});
+      });
+      if (position != end) {
+        throw ios::failure("Error compacting data");
+      }
+    }
+    // which records are live as of now, in the order they are read again
+    vector<bool> keep(scanned.size(), false);
+    {
+      shared_lock<shared_mutex> read_lock(mutex);
+      if (generation != generation_copied) {
+        return;
+      }
+      // tombstones are only needed while older segments may hold the key
+      bool const oldest = segments.begin()->first == segment;
+      for (size_t i = 0; i < scanned.size(); i++) {
+        auto const it = index.find(scanned[i].key);
+        keep[i] = !scanned[i].tombstone
+          ? it != index.end() && it->second == scanned[i].location
+          : !oldest && it == index.end();
+      }
+    }
+    scanned = vector<Scanned>{};
+    vector<Moved> moved;
+    Segment compacted;
+    string const temp{segment_records(segment) + ".compact"};
+    {
+      ifstream stream_in(segment_records(segment), ios::binary);
+      ofstream stream_temp(temp, ios::binary | ios::trunc);
+      if (stream_in.fail() || stream_temp.fail()) {
+        throw ios::failure("Error compacting data");
+      }
+      // the records of the block being filled, and the first of them moved
+      ostringstream block;
+      size_t block_moved{0};
+      auto const seal = [&] () -> void {
+        string const records = block.str();
+        if (records.empty()) {
+          return;
+        }
+        string const compressed = Lz::compress(records);
+        write_record(stream_temp, RecordHeader::block, "", compressed);
+        compacted.packed_bytes += record_size("", compressed.length());
+        for (; block_moved < moved.size(); block_moved++) {
+          moved[block_moved].to.offset = compacted.packed_bytes -
+            static_cast<streamoff>(compressed.length());
+          moved[block_moved].to.block =
+            static_cast<uint32_t>(compressed.length());
+        }
+        block.str("");
+      };
+      size_t record{0};
+      streamoff position{0};
+      for_each_record(stream_in, segment, position, end,
+                      [&] (RecordHeader const& header, string const& key,
+                           string const& value, Location const& location)
+                        -> void {
+        if (record >= keep.size() || !keep[record++]) {
+          return;
+        }
+        bool const tombstone = header.flags & RecordHeader::tombstone;
+        compacted.size_bytes += record_size(key, value.length());
+        // a kept tombstone is dead weight, dropped once the segment is oldest
+        if (tombstone) {
+          compacted.dead += record_size(key, value.length());
+        }
+        Location to{segment, 0, value.length()};
+        if (compression == Compression::Blocks) {
+          to.within = static_cast<uint32_t>(
+            static_cast<streamoff>(block.tellp()) + record_size(key, 0));
+          write_record(block, header.flags, key, value);
+        } else {
+          write_record(stream_temp, header.flags, key, value);
+          to.offset = compacted.size_bytes - static_cast<streamoff>(
+                        value.length());
+        }
+        if (!tombstone) {
+          moved.push_back({key, location, to});
+        }
+        if (static_cast<size_t>(block.tellp()) >= block_bytes) {
+          seal();
+        }
+      });
+      seal();
+      stream_temp.close();
+      if (position != end || record != keep.size() || stream_temp.fail()) {
+        remove(temp.c_str());
+        throw ios::failure("Error compacting data");
+      }
+    }
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (generation != generation_copied || segments.count(segment) == 0) {
+      remove(temp.c_str());
+      return;
+    }
+    /* offsets in the segment change, so the checkpoint is dropped before,
+       and everything counts as appended since */
+    remove(filename_index.c_str());
+    appended = 0;
+    for (auto const& [id, state] : segments) {
+      appended += static_cast<size_t>(state.size());
+    }
+    // records overwritten or deleted during the copy are dead in the new file
+    for (auto const& record : moved) {
+      auto const it = index.find(record.key);
+      if (it != index.end() && it->second == record.from) {
+        it->second = record.to;
+      } else {
+        compacted.dead += record_size(record.key, record.to.length);
+      }
+    }
+    if (compacted.size() == 0) {
+      remove(temp.c_str());
+      remove(segment_records(segment).c_str());
+      segments.erase(segment);
+    } else {
+      rename(temp.c_str(), segment_records(segment).c_str());
+      segments[segment] = compacted;
+    }
+    unmap_segment(segment);
+  }
+
  public:
-  explicit Disk() {
-    ofstream stream_keys(filename_keys, ios::app);
-    ofstream stream_values(filename_values, ios::app);
+  /* a sealed segment is compacted in the background once more than
+     "compaction_ratio" of its bytes belong to overwritten or deleted
+     records, the active segment is sealed once it reaches "segment_bytes";
+     with "checkpoint_bytes" above 0 the index is checkpointed in the
+     background whenever that many bytes were appended since the last time */
+  explicit Disk(double const compaction_ratio = default_compaction_ratio,
+                size_t const segment_bytes = default_segment_bytes,
+                Reads const reads = Reads::Mapped,
+                Lifetime const lifetime = Lifetime::Temporary,
+                size_t const checkpoint_bytes = 0,
+                Compression const compression = Compression::None)
+    : compaction_ratio(compaction_ratio),
+      segment_bytes(static_cast<streamoff>(segment_bytes)),
+      reads(reads),
+      lifetime(lifetime),
+      checkpoint_bytes(checkpoint_bytes),
+      compression(compression) {
+    rebuild();
+    open();
+    compactor = thread(&Disk::run_compactor, this);
+    // sealed segments written without compression
+    if (compression == Compression::Blocks) {
+      wake();
+    }
+  }
+  ~Disk() {
+    {
+      lock_guard<std::mutex> lock(compactor_mutex);
+      compactor_stopping = true;
+    }
+    compactor_wakeup.notify_one();
+    compactor.join();
+    if (lifetime == Lifetime::Persistent) {
+      close();
+      try {
+        checkpoint();
+      } catch (ios::failure const&) {
+        // the next open replays all segments
+      }
+    } else {
+      delAll();
+    }
   }
-  ~Disk() { delAll(); }
   Disk(Disk const&) = delete;
   Disk(Disk &&) noexcept = delete;
   Disk &operator=(Disk const&) = delete;
   Disk &operator=(Disk &&) noexcept = delete;
 
+  // throws length_error for a key or value longer than a record can hold
   void put(string const& key, string const& value) {
+    if (!RecordHeader::fits(key.length(), value.length())) {
+      throw length_error("Record too long for the disk");
+    }
     unique_lock<shared_mutex> write_lock(mutex);
-    ofstream stream_keys(filename_keys, ios::app);
-    ofstream stream_values(filename_values, ios::app);
-    if (stream_keys.fail() || stream_values.fail()) {
-      throw ios::failure("Error putting data into file");
-    } else {
-      stream_keys << key << endl;
-      stream_values << value << endl;
+    streamoff const offset = append(0, key, value);
+    flush();
+    supersede(key);
+    place(key, Location{active, offset, value.length()});
+    roll();
+  }
+
+  // appends all records with a single flush, a later record of a key wins
+  void put(vector<pair<string, string>> const& records) {
+    put_all(records);
+  }
+  void put(vector<pair<string, shared_ptr<string const>>> const& records) {
+    put_all(records);
+  }
+  // same for any range of key-value pairs
+  template<typename Records>
+  void put_all(Records const& records) {
+    // nothing is appended if any of the records is too long
+    for (auto const& [key, value] : records) {
+      if (!RecordHeader::fits(key.length(), bytes(value).length())) {
+        throw length_error("Record too long for the disk");
+      }
+    }
+    unique_lock<shared_mutex> write_lock(mutex);
+    vector<Location> locations;
+    locations.reserve(records.size());
+    for (auto const& [key, value] : records) {
+      size_t const segment = active;
+      streamoff const offset = append(0, key, bytes(value));
+      locations.push_back({segment, offset, bytes(value).length()});
+      roll();
+    }
+    flush();
+    auto location = locations.begin();
+    for (auto const& [key, value] : records) {
+      supersede(key);
+      place(key, *location++);
     }
   }
 
   optional<string> get(string const& key) {
+    optional<View> const maybe_view = view(key);
+    if (maybe_view.has_value()) {
+      return optional<string>{string(maybe_view->value)};
+    } else {
+      return nullopt;
+    }
+  }
+
+  /* with mapped reads the view points into the mapping of the segment and
+     outlives later puts, deletes and compactions of the key */
+  optional<View> view(string const& key) {
     shared_lock<shared_mutex> read_lock(mutex);
-    ifstream stream_keys(filename_keys);
-    ifstream stream_values(filename_values);
-    if (stream_keys.fail() || stream_values.fail()) {
-      throw ios::failure("Error getting data from file");
+    return locate(key);
+  }
+
+  // looks all "keys" up under one lock, in their order
+  vector<optional<string>> get(vector<string> const& keys) {
+    vector<optional<string>> values;
+    values.reserve(keys.size());
+    shared_lock<shared_mutex> read_lock(mutex);
+    for (auto const& key : keys) {
+      optional<View> const maybe_view = locate(key);
+      if (maybe_view.has_value()) {
+        values.emplace_back(string(maybe_view->value));
+      } else {
+        values.emplace_back(nullopt);
+      }
+    }
+    return values;
+  }
+
+ private:
+  // the decompressed block a location points into, the disk has to be locked
+  shared_ptr<string const> load_block(Location const& location) {
+    shared_ptr<string const> records =
+      block_cache.get(location.segment, location.offset);
+    if (records != nullptr) {
+      return records;
+    }
+    optional<string> decompressed;
+    if (reads == Reads::Mapped) {
+      auto const mapping = map_segment(
+        location.segment, static_cast<size_t>(location.offset) + location.block);
+      decompressed = Lz::decompress(string_view{
+        static_cast<char const*>(mapping->address) + location.offset,
+        location.block});
     } else {
-      string string_key, string_value;
-      while (getline(stream_keys, string_key) &&
-             getline(stream_values, string_value)) {
-        if (string_key == key) {
-          return optional<string>{string_value};
-        }
+      ifstream stream(segment_records(location.segment), ios::binary);
+      string compressed(location.block, '\0');
+      if (stream.fail() ||
+          !stream.seekg(location.offset) ||
+          !stream.read(compressed.data(), location.block)) {
+        throw ios::failure("Error getting data from file");
       }
+      decompressed = Lz::decompress(compressed);
+    }
+    if (!decompressed.has_value() ||
+        decompressed->length() < location.within + location.length) {
+      throw ios::failure("Error decompressing data");
+    }
+    records = make_shared<string const>(move(*decompressed));
+    block_cache.put(location.segment, location.offset, records);
+    return records;
+  }
+
+  // the disk has to be locked
+  optional<View> locate(string const& key) {
+    if (!filter.may_contain(key)) {
+      ++filter_negatives;
+      return nullopt;
+    }
+    auto const it = index.find(key);
+    if (it == index.end()) {
+      ++filter_false_positives;
+      return nullopt;
+    }
+    auto const& [segment, offset, length, block, within] = it->second;
+    if (block > 0) {
+      shared_ptr<string const> records = load_block(it->second);
+      string_view const value{records->data() + within, length};
+      return optional<View>{View{move(records), value}};
+    }
+    if (reads == Reads::Mapped) {
+      if (length == 0) {
+        return optional<View>{View{nullptr, string_view{}}};
+      }
+      auto mapping = map_segment(segment, static_cast<size_t>(offset) + length);
+      string_view const value{static_cast<char const*>(mapping->address) +
+                              offset, length};
+      return optional<View>{View{move(mapping), value}};
+    }
+    ifstream stream(segment_records(segment), ios::binary);
+    auto value = make_shared<string>(length, '\0');
+    if (stream.fail() ||
+        !stream.seekg(offset) ||
+        !stream.read(value->data(), length)) {
+      throw ios::failure("Error getting data from file");
+    }
+    string_view const view{*value};
+    return optional<View>{View{move(value), view}};
+  }
+ public:
+
+  /* false means that the key is not on the disk, without building a string
+     of it or probing the index */
+  bool may_contain(string_view const key) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    if (filter.may_contain(key)) {
+      return true;
     }
-    return nullopt;
+    ++filter_negatives;
+    return false;
+  }
+
+  FilterStats filter_stats() {
+    shared_lock<shared_mutex> read_lock(mutex);
+    return FilterStats{filter.size(), filter.memory(),
+                       filter.false_positive_rate(), filter_negatives.load(),
+                       filter_false_positives.load()};
+  }
+
+  // lookups of compressed values served by the cache of decompressed blocks
+  BlockCache::Stats block_stats() {
+    return block_cache.stats();
   }
 
+  // appends a tombstone, the space is reclaimed by compaction
   bool del(string const& key) {
     unique_lock<shared_mutex> write_lock(mutex);
-    bool ret{false};
-    ifstream stream_keys(filename_keys), stream_values(filename_values);
-    ofstream stream_keys_temp("temp_keys"), stream_values_temp("temp_values");
-    if (stream_keys.fail() ||
-        stream_values.fail() ||
-        stream_keys_temp.fail() ||
-        stream_values_temp.fail()) {
-      throw ios::failure("Error getting data");
-    } else {
-      string string_key, string_value;
-      while (getline(stream_keys, string_key) &&
-             getline(stream_values, string_value)) {
-        if (string_key != key) {
-          stream_keys_temp << string_key << endl;
-          stream_values_temp << string_value << endl;
-        } else {
-          ret = true;
+    if (!erase(key)) {
+      return false;
+    }
+    flush();
+    return true;
+  }
+
+  // appends the tombstones of all present "keys" with a single flush
+  size_t del(vector<string> const& keys) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    size_t deleted{0};
+    for (auto const& key : keys) {
+      deleted += erase(key);
+    }
+    flush();
+    return deleted;
+  }
+
+  /* writes the index and the sizes of all segments, so that opening the
+     disk only replays what was appended afterwards */
+  void checkpoint() {
+    // one checkpoint at a time, and none while a compaction pass runs
+    lock_guard<std::mutex> lock(compaction_mutex);
+    shared_lock<shared_mutex> read_lock(mutex);
+    write_index();
+  }
+
+  // compacts every sealed segment over the threshold
+  void compact() {
+    lock_guard<std::mutex> lock(compaction_mutex);
+    vector<size_t> candidates;
+    {
+      shared_lock<shared_mutex> read_lock(mutex);
+      for (auto const& [segment, state] : segments) {
+        if (segment != active && compactable(state)) {
+          candidates.push_back(segment);
         }
       }
-      stream_keys.close();
-      stream_values.close();
-      stream_keys_temp.close();
-      stream_values_temp.close();
-      remove(filename_keys.c_str());
-      rename("temp_keys", filename_keys.c_str());
-      remove(filename_values.c_str());
-      rename("temp_values", filename_values.c_str());
     }
-    return ret;
+    for (auto const segment : candidates) {
+      compact(segment);
+    }
+  }
+
+  // bytes occupied by all segments, including dead records
+  size_t size() {
+    shared_lock<shared_mutex> read_lock(mutex);
+    streamoff size{0};
+    for (auto const& [segment, state] : segments) {
+      size += state.size();
+    }
+    return static_cast<size_t>(size);
   }
 
   // used for interactive demonstration
   void delAll() {
     unique_lock<shared_mutex> write_lock(mutex);
-    ofstream stream_keys(filename_keys),
-             stream_values(filename_values);
-    if (stream_keys.fail() || stream_values.fail()) {
-      throw ios::failure("Error putting data into file");
+    close();
+    for (auto const& [segment, state] : segments) {
+      remove(segment_records(segment).c_str());
+    }
+    remove(filename_index.c_str());
+    index.clear();
+    filter.clear();
+    segments.clear();
+    appended = 0;
+    {
+      lock_guard<std::mutex> lock(mappings_mutex);
+      mappings.clear();
     }
+    block_cache.clear();
+    active = 0;
+    ++generation;
+    open();
   }
 
   // used for interactive demonstration
   void printAll() {
-    shared_lock<shared_mutex> write_lock(mutex);
-    ifstream stream_keys(filename_keys),
-             stream_values(filename_values);
-    if (stream_keys.fail() || stream_values.fail()) {
-      throw ios::failure("Error getting data");
-    } else {
-      string string_key, string_value;
-      if (stream_keys.peek() == ifstream::traits_type::eof()) {
-        cout << "Disk is empty" << endl;
-      } else {
-        while (getline(stream_keys, string_key) &&
-               getline(stream_values, string_value)) {
-          cout << string_key << ":" << string_value << endl;
-        }
+    shared_lock<shared_mutex> read_lock(mutex);
+    if (index.empty()) {
+      cout << "Disk is empty" << endl;
+      return;
+    }
+    for (auto const& [segment, state] : segments) {
+      ifstream stream(segment_records(segment), ios::binary);
+      if (stream.fail()) {
+        throw ios::failure("Error getting data");
       }
+      streamoff position{0};
+      for_each_record(stream, segment, position, state.size(),
+                      [&] (RecordHeader const&, string const& key,
+                           string const& value, Location const& location)
+                        -> void {
+        auto const it = index.find(key);
+        if (it != index.end() && it->second == location) {
+          cout << key << ":" << value << endl;
+        }
+      });
     }
   }
 };
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+/* epoch-based reclamation: readers pin the current epoch in a slot of
+   their own while they follow shared pointers, writers retire what they
+   unlinked, and a retired object is freed once the epoch has advanced
+   twice past its retirement, which needs every pinned reader to have
+   seen the newer epoch; readers never write to shared cache lines */
+class Epoch final {
+ private:
+  static constexpr size_t number_of_slots{512};
+  // retired objects collected at once
+  static constexpr size_t batch{64};
+  // the epoch of a slot whose thread is not reading
+  static constexpr uint64_t quiescent{0};
+
+  struct alignas(64) Slot {
+    atomic<uint64_t> epoch{quiescent};
+    atomic<bool> claimed{false};
+  };
+
+  struct Retired {
+    uint64_t epoch;
+    void* object;
+    void (*destroy)(void*);
+  };
+
+  // a thread's slot, given back when the thread ends
+  struct Registration {
+    Slot* slot{nullptr};
+    size_t depth{0};
+
+    ~Registration() {
+      if (slot != nullptr) {
+        slot->claimed.store(false, memory_order_release);
+      }
+    }
+  };
+
+  array<Slot, number_of_slots> slots;
+  atomic<uint64_t> global{1};
+  std::mutex retired_mutex;
+  vector<Retired> retired;
+
+  Epoch() = default;
+
+  static Registration & registration() {
+    thread_local Registration registration;
+    return registration;
+  }
+
+  Slot & claim() {
+    for (auto & slot : slots) {
+      bool expected{false};
+      if (!slot.claimed.load(memory_order_relaxed) &&
+          slot.claimed.compare_exchange_strong(expected, true)) {
+        return slot;
+      }
+    }
+    throw runtime_error("Too many threads reading");
+  }
+
+  // frees what no reader can see any more, "retired_mutex" has to be held
+  void collect() {
+    /* orders the unlinking of every retired object before the slots are
+       read, pairs with the fence after a reader's pin: either the reader
+       sees the object unlinked or this sees the reader pinned */
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t const current = global.load();
+    bool advance{true};
+    for (auto const& slot : slots) {
+      uint64_t const epoch = slot.epoch.load();
+      if (epoch != quiescent && epoch != current) {
+        advance = false;
+        break;
+      }
+    }
+    uint64_t const safe = advance ? current + 1 : current;
+    if (advance) {
+      global.store(safe);
+    }
+    auto const end = partition(retired.begin(), retired.end(),
+      [safe] (Retired const& object) -> bool {
+        return object.epoch + 2 > safe;
+      });
+    for (auto it = end; it != retired.end(); ++it) {
+      it->destroy(it->object);
+    }
+    retired.erase(end, retired.end());
+  }
+
+ public:
+  ~Epoch() {
+    for (auto const& object : retired) {
+      object.destroy(object.object);
+    }
+  }
+  Epoch(Epoch const&) = delete;
+  Epoch(Epoch &&) noexcept = delete;
+  Epoch &operator=(Epoch const&) = delete;
+  Epoch &operator=(Epoch &&) noexcept = delete;
+
+  // one domain for the whole process, so that a thread needs one slot
+  static Epoch & domain() {
+    static Epoch epoch;
+    return epoch;
+  }
+
+  // pins the current epoch for as long as it lives, guards may nest
+  class Guard final {
+   private:
+    Registration & registration;
+
+   public:
+    Guard() : registration(Epoch::registration()) {
+      if (registration.depth++ == 0) {
+        if (registration.slot == nullptr) {
+          registration.slot = &domain().claim();
+        }
+        registration.slot->epoch.store(domain().global.load());
+        /* the pin has to be visible before the reader loads any shared
+           pointer, or a reclaimer could miss it and free what the reader
+           is about to follow; an acquire load alone may be ordered before
+           the store. Pairs with the fence in collect() */
+        atomic_thread_fence(memory_order_seq_cst);
+      }
+    }
+    ~Guard() {
+      if (--registration.depth == 0) {
+        registration.slot->epoch.store(quiescent, memory_order_release);
+      }
+    }
+    Guard(Guard const&) = delete;
+    Guard(Guard &&) noexcept = delete;
+    Guard &operator=(Guard const&) = delete;
+    Guard &operator=(Guard &&) noexcept = delete;
+  };
+
+  // "object" has to be unreachable for readers that start from now on
+  template<typename T>
+  void retire(T* const object) {
+    lock_guard<std::mutex> lock(retired_mutex);
+    retired.push_back({global.load(), object, [] (void* const pointer) {
+      delete static_cast<T*>(pointer);
+    }});
+    if (retired.size() >= batch) {
+      collect();
+    }
+  }
+
+  // frees whatever can be freed now, returns how many objects still wait
+  size_t reclaim() {
+    lock_guard<std::mutex> lock(retired_mutex);
+    collect();
+    collect();
+    return retired.size();
+  }
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/* counting Bloom filter over a set of keys: 4-bit counters, so that keys can
+   be removed again; a saturated counter is never decremented, which keeps
+   the filter free of false negatives at the price of a stuck bit */
+class CountingFilter final {
+ private:
+  // ~1% false positives at 10 counters per key with 7 hashes
+  static constexpr size_t counters_per_key{10};
+  static constexpr size_t number_of_hashes{7};
+  static constexpr uint8_t saturated{15};
+
+  vector<uint8_t> counters;
+  size_t number_of_counters;
+  size_t number_of_keys{0};
+
+  // double hashing: the i-th probe is h1 + i * h2
+  static pair<uint64_t, uint64_t> hashes(string_view const key) {
+    uint64_t const h1 = hash<string_view>{}(key);
+    uint64_t h2 = h1 * 0x9E3779B97F4A7C15ULL;
+    h2 ^= h2 >> 29;
+    return {h1, h2 | 1};
+  }
+
+  uint8_t counter(size_t const i) const {
+    return (counters[i >> 1] >> ((i & 1) << 2)) & 0x0F;
+  }
+
+  void set_counter(size_t const i, uint8_t const value) {
+    uint8_t const shift = static_cast<uint8_t>((i & 1) << 2);
+    counters[i >> 1] = static_cast<uint8_t>(
+      (counters[i >> 1] & ~(0x0F << shift)) | (value << shift));
+  }
+
+  template<typename Visitor>
+  void probe(string_view const key, Visitor && visitor) const {
+    auto const [h1, h2] = hashes(key);
+    for (size_t i = 0; i < number_of_hashes; i++) {
+      visitor(static_cast<size_t>((h1 + i * h2) % number_of_counters));
+    }
+  }
+
+ public:
+  // sized for "capacity" keys, it has to be rebuilt to keep its rate beyond
+  explicit CountingFilter(size_t const capacity = 1024)
+    : counters((max<size_t>(capacity, 1) * counters_per_key + 1) / 2),
+      number_of_counters(max<size_t>(capacity, 1) * counters_per_key) {}
+
+  void add(string_view const key) {
+    probe(key, [this] (size_t const i) -> void {
+      uint8_t const value = counter(i);
+      if (value < saturated) {
+        set_counter(i, static_cast<uint8_t>(value + 1));
+      }
+    });
+    ++number_of_keys;
+  }
+
+  // "key" must have been added before
+  void remove(string_view const key) {
+    probe(key, [this] (size_t const i) -> void {
+      uint8_t const value = counter(i);
+      if (value < saturated) {
+        set_counter(i, static_cast<uint8_t>(value - 1));
+      }
+    });
+    --number_of_keys;
+  }
+
+  bool may_contain(string_view const key) const {
+    bool contained{true};
+    probe(key, [this, &contained] (size_t const i) -> void {
+      contained = contained && counter(i) != 0;
+    });
+    return contained;
+  }
+
+  // starts over with room for "capacity" keys and the given ones in it
+  template<typename Keys>
+  void rebuild(size_t const capacity, Keys const& keys) {
+    *this = CountingFilter(capacity);
+    for (auto const& [key, value] : keys) {
+      add(key);
+    }
+  }
+
+  void clear() {
+    fill(counters.begin(), counters.end(), 0);
+    number_of_keys = 0;
+  }
+
+  size_t size() const noexcept {
+    return number_of_keys;
+  }
+
+  size_t capacity() const noexcept {
+    return number_of_counters / counters_per_key;
+  }
+
+  size_t memory() const noexcept {
+    return counters.size();
+  }
+
+  // expected share of absent keys that pass the filter, (1 - e^(-kn/m))^k
+  double false_positive_rate() const {
+    double const k = static_cast<double>(number_of_hashes);
+    double const fill = 1.0 - exp(-k * static_cast<double>(number_of_keys) /
+                                  static_cast<double>(number_of_counters));
+    return pow(fill, k);
+  }
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+using namespace std;
+
+/* log-linear histogram of durations in nanoseconds: every power of two is
+   split into 16 linear buckets, which bounds the error to ~6% */
+class Histogram final {
+ private:
+  static constexpr size_t sub_buckets{16};
+  static constexpr size_t sub_bits{4};
+
+ public:
+  static constexpr size_t number_of_buckets{(64 - sub_bits + 1) * sub_buckets};
+
+  // the bucket counting "value", for counts kept outside the histogram
+  static size_t bucket(uint64_t const value) {
+    if (value < sub_buckets) {
+      return static_cast<size_t>(value);
+    }
+    size_t const msb = 63 - static_cast<size_t>(__builtin_clzll(value));
+    return (msb - sub_bits + 1) * sub_buckets +
+           static_cast<size_t>(value >> (msb - sub_bits)) - sub_buckets;
+  }
+
+ private:
+  array<uint64_t, number_of_buckets> counts{};
+  uint64_t total{0};
+
+  static uint64_t lower_bound(size_t const bucket) {
+    if (bucket < sub_buckets) {
+      return bucket;
+    }
+    size_t const msb = bucket / sub_buckets + sub_bits - 1;
+    return (sub_buckets + bucket % sub_buckets) << (msb - sub_bits);
+  }
+
+ public:
+  void record(uint64_t const nanoseconds) noexcept {
+    ++counts[bucket(nanoseconds)];
+    ++total;
+  }
+
+  void add(size_t const bucket, uint64_t const count) noexcept {
+    counts[bucket] += count;
+    total += count;
+  }
+
+  void merge(Histogram const& other) noexcept {
+    for (size_t i = 0; i < number_of_buckets; i++) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+  }
+
+  uint64_t count() const noexcept {
+    return total;
+  }
+
+  // midpoint of the bucket holding the "quantile" (0..1) of all samples
+  uint64_t percentile(double const quantile) const noexcept {
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t const rank = static_cast<uint64_t>(quantile * (total - 1)) + 1;
+    uint64_t seen{0};
+    for (size_t i = 0; i < number_of_buckets; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        uint64_t const low = lower_bound(i);
+        uint64_t const high = i + 1 < number_of_buckets
+          ? lower_bound(i + 1) : low;
+        return low + (high - low) / 2;
+      }
+    }
+    return lower_bound(number_of_buckets - 1);
+  }
+};
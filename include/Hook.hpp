@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+
+using namespace std;
+
+/* eviction bookkeeping embedded in every cache entry: strategies link the
+   entries themselves instead of keeping copies of their keys; the fields
+   belong to the strategy and are guarded by its lock, so they may change
+   while the cache shard is only read-locked */
+struct Hook {
+  mutable Hook const* prev{nullptr};
+  mutable Hook const* next{nullptr};
+  // the strategy's list or bucket holding the entry, nullptr when unlinked
+  mutable void* owner{nullptr};
+  // set on access without any lock, by strategies that only mark hits
+  mutable atomic<bool> referenced{false};
+  // a view of the key owned by the entry
+  string_view key;
+};
+
+// circular doubly linked list of hooks, which never allocates
+class Chain final {
+ private:
+  Hook sentinel;
+
+  static void link(Hook const& hook, Hook const* const prev,
+                   Hook const* const next) noexcept {
+    hook.prev = prev;
+    hook.next = next;
+    prev->next = &hook;
+    next->prev = &hook;
+  }
+
+ public:
+  Chain() {
+    sentinel.prev = sentinel.next = &sentinel;
+  }
+  ~Chain() = default;
+  Chain(Chain const&) = delete;
+  Chain(Chain &&) noexcept = delete;
+  Chain &operator=(Chain const&) = delete;
+  Chain &operator=(Chain &&) noexcept = delete;
+
+  bool empty() const noexcept {
+    return sentinel.next == &sentinel;
+  }
+
+  Hook const* front() const noexcept {
+    return empty() ? nullptr : sentinel.next;
+  }
+
+  Hook const* back() const noexcept {
+    return empty() ? nullptr : sentinel.prev;
+  }
+
+  void push_front(Hook const& hook) noexcept {
+    link(hook, &sentinel, sentinel.next);
+  }
+
+  void push_back(Hook const& hook) noexcept {
+    link(hook, sentinel.prev, &sentinel);
+  }
+
+  void insert_before(Hook const& hook, Hook const& position) noexcept {
+    link(hook, position.prev, &position);
+  }
+
+  static void unlink(Hook const& hook) noexcept {
+    hook.prev->next = hook.next;
+    hook.next->prev = hook.prev;
+    hook.prev = hook.next = nullptr;
+  }
+
+  // the hook following "hook", wrapping around at the end
+  Hook const* after(Hook const& hook) const noexcept {
+    Hook const* const next = hook.next;
+    return next == &sentinel ? front() : next;
+  }
+
+  // forgets all hooks without touching them, they may be gone already
+  void clear() noexcept {
+    sentinel.prev = sentinel.next = &sentinel;
+  }
+
+  template<typename Visitor>
+  void visit(Visitor && visitor) const {
+    for (Hook const* hook = sentinel.next; hook != &sentinel; hook = hook->next)
+      visitor(*hook);
+  }
+
+  template<typename Visitor>
+  void visit_reverse(Visitor && visitor) const {
+    for (Hook const* hook = sentinel.prev; hook != &sentinel; hook = hook->prev)
+      visitor(*hook);
+  }
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+/* fixed set of worker threads running tasks that block on the disk, in the
+   order they were submitted; callers wait in submit() while "queue_limit"
+   tasks are waiting for a worker */
+class IoPool final {
+ private:
+  size_t const queue_limit;
+  deque<function<void()>> tasks;
+  bool stopping{false};
+
+  std::mutex mutex;
+  condition_variable workers_wakeup;
+  condition_variable submitters_wakeup;
+  vector<thread> workers;
+
+  void run_worker() {
+    unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      workers_wakeup.wait(lock, [this] () -> bool {
+        return stopping || !tasks.empty();
+      });
+      if (tasks.empty()) {
+        return;
+      }
+      function<void()> task = move(tasks.front());
+      tasks.pop_front();
+      submitters_wakeup.notify_one();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+ public:
+  explicit IoPool(size_t const threads, size_t const queue_limit)
+    : queue_limit(max<size_t>(queue_limit, 1)) {
+    for (size_t i = 0; i < max<size_t>(threads, 1); i++) {
+      workers.emplace_back(&IoPool::run_worker, this);
+    }
+  }
+  // every submitted task runs before the workers stop
+  ~IoPool() {
+    {
+      lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    workers_wakeup.notify_all();
+    for (auto & worker : workers) {
+      worker.join();
+    }
+  }
+  IoPool(IoPool const&) = delete;
+  IoPool(IoPool &&) noexcept = delete;
+  IoPool &operator=(IoPool const&) = delete;
+  IoPool &operator=(IoPool &&) noexcept = delete;
+
+  // the future holds the task's result, or the exception it threw
+  template<typename Task>
+  future<invoke_result_t<Task>> submit(Task && task) {
+    auto packaged = make_shared<packaged_task<invoke_result_t<Task>()>>(
+      forward<Task>(task));
+    auto result = packaged->get_future();
+    {
+      unique_lock<std::mutex> lock(mutex);
+      submitters_wakeup.wait(lock, [this] () -> bool {
+        return tasks.size() < queue_limit;
+      });
+      tasks.emplace_back([packaged] () -> void { (*packaged)(); });
+    }
+    workers_wakeup.notify_one();
+    return result;
+  }
+
+  size_t size() const {
+    return workers.size();
+  }
+};
@@ -1,78 +1,848 @@
+#pragma once
+
 #include <Cache.hpp>
 #include <Disk.hpp>
+#include <IoPool.hpp>
+#include <Metrics.hpp>
+#include <Staging.hpp>
 #include <Strategy.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// what one write moved from the cache to the disk to make room for itself
+struct Evicted {
+  size_t entries{0};
+  size_t bytes{0};
+};
 
 template<typename Strategy>
 class KeyValueStore final {
  private:
-  Strategy strategy;
+  // one eviction order per cache shard, each owning a share of the budget
+  unique_ptr<Strategy[]> strategies;
   size_t const size_max_cache;
+  size_t const compression_threshold;
+  Disk::Lifetime const lifetime;
+  Metrics metrics;
+
+  // written by checkpoint() next to the disk's files
+  string const filename_snapshot{"Storage_snapshot"};
+  static constexpr char snapshot_magic[8] = {'K', 'V', 'S', 'N', 'A', 'P',
+                                             '2', '\n'};
+  /* keys deleted since the snapshot was written, restore() skips them; it
+     belongs to the snapshot of the same generation */
+  string const filename_deleted{"Storage_snapshot.deleted"};
+  static constexpr char deleted_magic[8] = {'K', 'V', 'D', 'E', 'L', 'E',
+                                            '1', '\n'};
+  uint64_t generation{0};
+  // open from the first checkpoint on
+  ofstream deleted_journal;
+  std::mutex deleted_mutex;
+
+  using Records = vector<pair<string, shared_ptr<string const>>>;
+
+  // lookups waiting for an I/O worker before retrieve_async() blocks
+  static constexpr size_t io_queue_per_thread{64};
+
+  /* a record the disk could not hold is refused before it is cached, its
+     eviction would fail after it left the cache */
+  static void check_length(string_view const key, string const& value) {
+    if (!RecordHeader::fits(key.length(), value.length())) {
+      throw length_error("Record too long for the disk");
+    }
+  }
+
+  /* replaces a value of at least "compression_threshold" bytes by its
+     compressed form, unless that is not smaller; true if it did */
+  bool pack(string & value) {
+    if (compression_threshold == 0 || value.length() < compression_threshold) {
+      return false;
+    }
+    string compressed;
+    {
+      Metrics::Stopwatch const stopwatch(metrics,
+                                         Metrics::Event::CompressionNanos);
+      compressed = Lz::compress(value);
+    }
+    if (compressed.length() >= value.length()) {
+      return false;
+    }
+    metrics.count(Metrics::Event::Compressions);
+    metrics.count(Metrics::Event::CompressionInput, value.length());
+    metrics.count(Metrics::Event::CompressionOutput, compressed.length());
+    value = move(compressed);
+    return true;
+  }
+
+  // the form a value read elsewhere takes in the cache, with its flag
+  pair<shared_ptr<string const>, bool> pack(
+      Cache::Writer & writer, shared_ptr<string const> const& value) {
+    if (compression_threshold == 0 ||
+        value->length() < compression_threshold) {
+      return {value, false};
+    }
+    string bytes{*value};
+    if (!pack(bytes)) {
+      return {value, false};
+    }
+    return {writer.make_value(move(bytes)), true};
+  }
+
+  // the value of a cache entry as it was recorded
+  shared_ptr<string const> unpack(Cache::Entry const& entry) {
+    if (!entry.compressed) {
+      return entry.value;
+    }
+    metrics.count(Metrics::Event::Decompressions);
+    Metrics::Stopwatch const stopwatch(metrics,
+                                       Metrics::Event::DecompressionNanos);
+    return entry.plain();
+  }
+
+  /* moves the strategy's next victim out of the cache into "victims"; false
+     if the strategy has none left */
+  bool evict(Cache::Writer & writer, Strategy & strategy, Records & victims,
+             Evicted & evicted) {
+    Hook const* const hook = strategy.onEviction();
+    if (hook == nullptr) {
+      return false;
+    }
+    string victim{hook->key};
+    // the disk keeps values as they were recorded
+    shared_ptr<string const> victim_value = unpack(*writer.find(victim));
+    writer.take(victim);
+    ++evicted.entries;
+    evicted.bytes += victim.length() + victim_value->length();
+    metrics.count(Metrics::Event::Evictions);
+    metrics.count(Metrics::Event::EvictedBytes,
+                  victim.length() + victim_value->length());
+    victims.emplace_back(move(victim), move(victim_value));
+    return true;
+  }
+
+  /* puts one record, the victims making room for it are left to spill();
+     a record read back from a snapshot is linked with its saved "state".
+     False if the record is too large for one shard's share of the budget,
+     it is then not cached and an older value of the key is dropped */
+  bool place(Cache::Writer & writer, Strategy & strategy,
+             string_view const key, shared_ptr<string const> const& value,
+             bool const compressed, Records & victims, Evicted & evicted,
+             size_t const* const state = nullptr) {
+    if (writer.size_of(key, *value) >= size_max_cache) {
+      Cache::Entry const* const entry = writer.find(key);
+      if (entry != nullptr) {
+        strategy.onDelete(*entry);
+        writer.take(key);
+      }
+      return false;
+    }
+    while (writer.size_after(key, *value) > size_max_cache &&
+           !writer.empty()) {
+      if (!evict(writer, strategy, victims, evicted)) {
+        break;
+      }
+    }
+
+    auto const [entry, inserted] = writer.put(key, value, compressed);
+    if (inserted && state != nullptr) {
+      strategy.onRestore(*entry, *state);
+    } else if (inserted) {
+      strategy.onRecord(*entry);
+    } else {
+      strategy.onAccess(*entry);
+    }
+    // a slab-backed table may have grown its bucket array on the insert
+    while (writer.size() > size_max_cache && !writer.empty()) {
+      if (!evict(writer, strategy, victims, evicted)) {
+        break;
+      }
+    }
+    return true;
+  }
+
+  /* places a record, one the shard cannot hold goes to the disk with the
+     victims instead */
+  void place_or_spill(Cache::Writer & writer, Strategy & strategy,
+                      string_view const key,
+                      shared_ptr<string const> const& value,
+                      bool const compressed, Records & victims,
+                      Evicted & evicted, size_t const* const state = nullptr) {
+    if (!place(writer, strategy, key, value, compressed, victims, evicted,
+               state)) {
+      // the disk keeps values as they were recorded
+      victims.emplace_back(string{key}, Cache::inflate(value, compressed));
+    }
+  }
+
+  /* hands the victims over with a single append, before the shards they
+     left are unlocked, so that readers always find them somewhere */
+  void spill(Records && victims) {
+    if (!victims.empty()) {
+      Metrics::Timer const timer(metrics, Metrics::Latency::DiskWrite);
+      if (staging) {
+        staging->put(move(victims));
+      } else {
+        disk.put(victims);
+      }
+    }
+  }
+
+  Evicted record(Cache::Writer & writer, Strategy & strategy,
+                 string_view const key, shared_ptr<string const> value,
+                 bool const compressed) {
+    // every victim needed to make room leaves the cache in one pass
+    Evicted evicted;
+    Records victims;
+    place_or_spill(writer, strategy, key, value, compressed, victims,
+                   evicted);
+    spill(move(victims));
+    return evicted;
+  }
+
+  /* answers "key" under the shard's shared lock where that is enough: with
+     the cached value, or with nullptr when no tier can hold the key; nullopt
+     when the staging buffer and the disk have to be searched */
+  optional<shared_ptr<string const>> retrieve_cached(string_view const key,
+                                                     Metrics::Timer & timer) {
+    size_t const shard = cache.shard(key);
+    // the shared lock keeps the key from being evicted before it is accessed
+    Cache::Reader const reader = cache.read(shard);
+    Cache::Entry const* const entry = reader.find(key);
+    if (entry != nullptr) {
+      strategies[shard].onAccess(*entry);
+      metrics.count(Metrics::Event::CacheHits);
+      timer.set(Metrics::Latency::RetrieveCache);
+      return unpack(*entry);
+    }
+    /* nothing can be evicted while the shard is read-locked, so a key that
+       is neither staged nor passes the disk's filter is a miss */
+    if ((!staging || !staging->holds(key)) && !disk.may_contain(key)) {
+      metrics.count(Metrics::Event::CacheMisses);
+      metrics.count(Metrics::Event::DiskMisses);
+      return shared_ptr<string const>{};
+    }
+    return nullopt;
+  }
+
+  /* looks "key" up again under the shard's exclusive lock and promotes it
+     from the staging buffer or the disk into the cache */
+  shared_ptr<string const> retrieve_promoted(string_view const key,
+                                             Metrics::Timer & timer) {
+    size_t const shard = cache.shard(key);
+    Strategy & strategy = strategies[shard];
+    Cache::Writer writer = cache.write(shard);
+    // another thread may have promoted the key in the meantime
+    Cache::Entry const* const entry = writer.find(key);
+    if (entry != nullptr) {
+      strategy.onAccess(*entry);
+      metrics.count(Metrics::Event::CacheHits);
+      timer.set(Metrics::Latency::RetrieveCache);
+      return unpack(*entry);
+    }
+    metrics.count(Metrics::Event::CacheMisses);
+    string const owned_key{key};
+    if (staging) {
+      shared_ptr<string const> staged_value = staging->take(owned_key);
+      if (staged_value) {
+        metrics.count(Metrics::Event::StagingHits);
+        timer.set(Metrics::Latency::RetrieveDisk);
+        auto const [stored, compressed] = pack(writer, staged_value);
+        record(writer, strategy, key, stored, compressed);
+        return staged_value;
+      }
+    }
+    optional<string> maybe_disk_value;
+    // a key promoted while being appended may be deleted since
+    if (!staging || !staging->superseded(key)) {
+      Metrics::Timer const disk_timer(metrics, Metrics::Latency::DiskRead);
+      maybe_disk_value = disk.get(owned_key);
+    }
+    if (maybe_disk_value.has_value()) {
+      metrics.count(Metrics::Event::DiskHits);
+      timer.set(Metrics::Latency::RetrieveDisk);
+      auto disk_value = writer.make_value(move(maybe_disk_value.value()));
+      auto const [stored, compressed] = pack(writer, disk_value);
+      Evicted evicted;
+      Records victims;
+      // a value too large for the shard stays where it is
+      if (place(writer, strategy, key, stored, compressed, victims,
+                evicted)) {
+        disk.del(owned_key);
+      }
+      spill(move(victims));
+      return disk_value;
+    } else {
+      metrics.count(Metrics::Event::DiskMisses);
+      return nullptr;
+    }
+  }
+
+  // positions of "keys" by shard
+  vector<vector<size_t>> group(vector<string_view> const& keys) const {
+    vector<vector<size_t>> groups(cache.shard_count());
+    for (size_t i = 0; i < keys.size(); i++) {
+      groups[cache.shard(keys[i])].push_back(i);
+    }
+    return groups;
+  }
+
+  /* write-locks every shard with keys in "groups", in ascending order, so
+     that batches never wait on each other in a cycle */
+  vector<optional<Cache::Writer>> lock(
+      vector<vector<size_t>> const& groups) {
+    vector<optional<Cache::Writer>> writers(groups.size());
+    for (size_t shard = 0; shard < groups.size(); shard++) {
+      if (!groups[shard].empty()) {
+        writers[shard].emplace(cache.write(shard));
+      }
+    }
+    return writers;
+  }
+
+  static void write_number(ostream & stream, uint64_t const number) {
+    stream.write(reinterpret_cast<char const*>(&number), sizeof(number));
+  }
+
+  static uint64_t read_number(istream & stream) {
+    uint64_t number{0};
+    stream.read(reinterpret_cast<char*>(&number), sizeof(number));
+    return number;
+  }
+
+  static string read_string(istream & stream) {
+    string bytes(read_number(stream), '\0');
+    stream.read(bytes.data(), static_cast<streamsize>(bytes.length()));
+    return bytes;
+  }
+
+  // appends "keys" to the journal of deletions, if there is a snapshot
+  void journal_deleted(vector<string_view> const& keys) {
+    lock_guard<std::mutex> lock(deleted_mutex);
+    if (!deleted_journal.is_open() || keys.empty()) {
+      return;
+    }
+    for (auto const key : keys) {
+      write_number(deleted_journal, key.length());
+      deleted_journal.write(key.data(), static_cast<streamsize>(key.length()));
+    }
+    deleted_journal.flush();
+  }
+
+  // the keys journaled for the snapshot of "generation", a torn key is left out
+  unordered_set<string> read_deleted() {
+    unordered_set<string> deleted;
+    ifstream stream(filename_deleted, ios::binary);
+    char magic[sizeof(deleted_magic)];
+    stream.read(magic, sizeof(magic));
+    if (!stream || !equal(begin(magic), end(magic), begin(deleted_magic)) ||
+        read_number(stream) != generation) {
+      return deleted;
+    }
+    while (true) {
+      string key = read_string(stream);
+      if (!stream) {
+        return deleted;
+      }
+      deleted.insert(move(key));
+    }
+  }
+
+  /* reads the snapshot back in the saved order, so that the strategies end
+     up as they were; a key the disk holds was written there after the
+     snapshot and is newer, a key in the journal of deletions was deleted
+     after it. The snapshot is removed once loaded, a crash before the next
+     checkpoint then loses the cache. Values recorded after the snapshot
+     was written are lost with a crash, an overwritten key comes back with
+     the value it had in the snapshot */
+  void restore() {
+    ifstream stream(filename_snapshot, ios::binary);
+    if (stream.fail()) {
+      remove(filename_deleted.c_str());
+      return;
+    }
+    char magic[sizeof(snapshot_magic)];
+    stream.read(magic, sizeof(magic));
+    if (!stream || !equal(begin(magic), end(magic), begin(snapshot_magic))) {
+      throw ios::failure("Error reading snapshot");
+    }
+    generation = read_number(stream);
+    unordered_set<string> const deleted = read_deleted();
+    Evicted evicted;
+    for (uint64_t records = read_number(stream); records > 0; records--) {
+      size_t const state = read_number(stream);
+      string const key = read_string(stream);
+      string value = read_string(stream);
+      if (!stream) {
+        throw ios::failure("Error reading snapshot");
+      }
+      if (deleted.count(key) > 0 ||
+          (disk.may_contain(key) && disk.get(key).has_value())) {
+        continue;
+      }
+      bool const compressed = pack(value);
+      size_t const shard = cache.shard(key);
+      Cache::Writer writer = cache.write(shard);
+      Records victims;
+      place_or_spill(writer, strategies[shard], key,
+                     writer.make_value(move(value)), compressed, victims,
+                     evicted, &state);
+      spill(move(victims));
+    }
+    stream.close();
+    remove(filename_snapshot.c_str());
+    remove(filename_deleted.c_str());
+  }
 
  public:
   Cache cache;
   Disk disk;
+  // write-behind buffer in front of the disk, absent in synchronous mode
+  unique_ptr<Staging> staging;
+  // workers for the disk lookups of retrieve_async(), absent without them
+  unique_ptr<IoPool> io_pool;
 
-  explicit KeyValueStore(size_t const bytes)
-    : size_max_cache(bytes) {}
-  ~KeyValueStore() = default;
+  /* every shard holds up to "bytes" / "shards", a record larger than that
+     is not cached but written to the disk, and read from there;
+     with "staging_bytes" above 0 evicted records are written to the disk in
+     the background, and writers wait once that many bytes are staged;
+     "storage" decides whether "bytes" counts payload or allocated memory;
+     a "Persistent" store reopens the disk's files and the last snapshot,
+     and writes a snapshot when it is destroyed; with "compression_threshold"
+     above 0 values of at least that many bytes are kept compressed in the
+     cache, and charged as such; "io_threads" workers search the disk for
+     retrieve_async() */
+  explicit KeyValueStore(size_t const bytes, size_t const shards = 1,
+                         size_t const staging_bytes = 0,
+                         Cache::Storage const storage = Cache::Storage::Heap,
+                         Disk::Lifetime const lifetime =
+                           Disk::Lifetime::Temporary,
+                         size_t const compression_threshold = 0,
+                         size_t const io_threads = 0)
+    : strategies(make_unique<Strategy[]>(max<size_t>(shards, 1))),
+      size_max_cache(bytes / max<size_t>(shards, 1)),
+      compression_threshold(compression_threshold),
+      lifetime(lifetime),
+      cache(shards, storage),
+      disk(Disk::default_compaction_ratio, Disk::default_segment_bytes,
+           Disk::Reads::Mapped, lifetime),
+      staging(staging_bytes > 0
+        ? make_unique<Staging>(disk, staging_bytes)
+        : nullptr),
+      io_pool(io_threads > 0
+        ? make_unique<IoPool>(io_threads, io_threads * io_queue_per_thread)
+        : nullptr) {
+    if (lifetime == Disk::Lifetime::Persistent) {
+      restore();
+    }
+  }
+  ~KeyValueStore() {
+    // queued lookups still promote their keys into the snapshot
+    io_pool.reset();
+    if (lifetime == Disk::Lifetime::Persistent) {
+      try {
+        checkpoint();
+      } catch (ios::failure const&) {
+        // the disk is kept, only the cache comes back cold
+      }
+    }
+  }
   KeyValueStore(KeyValueStore const&) = delete;
   KeyValueStore(KeyValueStore &&) noexcept = delete;
   KeyValueStore &operator=(KeyValueStore const&) = delete;
   KeyValueStore &operator=(KeyValueStore &&) noexcept = delete;
 
-  void record(string const& key, string const& value) {
-    size_t const incoming_size = cache.incoming_size_change(key, value);
-    if(incoming_size < size_max_cache) {
-      while (cache.size() + incoming_size > size_max_cache) {
-        strategy.onEviction(cache, disk);
+  /* the cache update, the strategy update and the evictions making room
+     for the key happen under one exclusive lock of the key's shard; a key
+     or value longer than a disk record can hold throws length_error */
+  Evicted record(string_view const key, string value) {
+    check_length(key, value);
+    Metrics::Timer const timer(metrics, Metrics::Latency::Record);
+    metrics.count(Metrics::Event::Records);
+    // compressed before the shard is locked
+    bool const compressed = pack(value);
+    size_t const shard = cache.shard(key);
+    Cache::Writer writer = cache.write(shard);
+    return record(writer, strategies[shard], key,
+                  writer.make_value(move(value)), compressed);
+  }
+
+  optional<string> retrieve(string_view const key) {
+    shared_ptr<string const> const value = retrieve_shared(key);
+    if (value) {
+      return optional<string>{*value};
+    } else {
+      return nullopt;
+    }
+  }
+
+  /* a cache hit hands out the cached buffer itself, without copying it; the
+     buffer is immutable and stays valid after the key is overwritten,
+     deleted or evicted */
+  shared_ptr<string const> retrieve_shared(string_view const key) {
+    Metrics::Timer timer(metrics, Metrics::Latency::RetrieveMiss);
+    optional<shared_ptr<string const>> answered = retrieve_cached(key, timer);
+    if (answered.has_value()) {
+      return move(answered.value());
+    }
+    return retrieve_promoted(key, timer);
+  }
+
+  /* a cache hit, and a miss of the whole store, complete on the calling
+     thread with a ready future; a key that may be staged or on the disk is
+     looked up and promoted by an I/O worker, so that the caller never waits
+     for the disk, only for room in the workers' queue. Without I/O threads
+     the lookup happens on the calling thread as well */
+  future<shared_ptr<string const>> retrieve_async(string_view const key) {
+    Metrics::Timer timer(metrics, Metrics::Latency::RetrieveMiss);
+    optional<shared_ptr<string const>> answered = retrieve_cached(key, timer);
+    if (!answered.has_value() && io_pool) {
+      // the worker times the lookup it does
+      timer.discard();
+      return io_pool->submit(
+        [this, owned_key = string{key}] () -> shared_ptr<string const> {
+          Metrics::Timer worker_timer(metrics, Metrics::Latency::RetrieveMiss);
+          return retrieve_promoted(owned_key, worker_timer);
+        });
+    }
+    promise<shared_ptr<string const>> result;
+    if (answered.has_value()) {
+      result.set_value(move(answered.value()));
+    } else {
+      try {
+        result.set_value(retrieve_promoted(key, timer));
+      } catch (...) {
+        result.set_exception(current_exception());
       }
+    }
+    return result.get_future();
+  }
 
-      if (cache.put(key, value)) {
-        strategy.onRecord(key);
-      } else {
-        strategy.onAccess(key);
+  /* records a batch of key-value pairs with every shard involved locked
+     once; the evictions of the whole batch reach the disk in one append */
+  Evicted record_many(vector<pair<string_view, string>> records) {
+    vector<string_view> keys;
+    keys.reserve(records.size());
+    for (auto const& [key, value] : records) {
+      check_length(key, value);
+      keys.push_back(key);
+    }
+    metrics.count(Metrics::Event::Records, records.size());
+    vector<bool> compressed(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+      compressed[i] = pack(records[i].second);
+    }
+    auto const groups = group(keys);
+    auto writers = lock(groups);
+    Evicted evicted;
+    Records victims;
+    for (size_t shard = 0; shard < groups.size(); shard++) {
+      for (auto const i : groups[shard]) {
+        Cache::Writer & writer = *writers[shard];
+        place_or_spill(writer, strategies[shard], keys[i],
+                       writer.make_value(move(records[i].second)),
+                       compressed[i], victims, evicted);
       }
     }
+    spill(move(victims));
+    return evicted;
   }
 
-  optional<string> retrieve(string const& key) {
-    optional<string> maybe_cache_value = cache.get(key);
-    if (maybe_cache_value.has_value()) {
-      strategy.onAccess(key);
-      return maybe_cache_value;
-    } else {
-      optional<string> maybe_disk_value = disk.get(key);
-      if (maybe_disk_value.has_value()) {
-        disk.del(key);
-        record(key, maybe_disk_value.value());
-        return maybe_disk_value;
-      } else {
-        return nullopt;
+  /* the values of "keys" in their order, nullptr for missing ones; hits are
+     served under shared locks, the misses of the whole batch are looked up
+     and removed from the disk in one pass each */
+  vector<shared_ptr<string const>> retrieve_many(
+      vector<string_view> const& keys) {
+    vector<shared_ptr<string const>> values(keys.size());
+    auto groups = group(keys);
+    bool missed{false};
+    for (size_t shard = 0; shard < groups.size(); shard++) {
+      if (groups[shard].empty()) {
+        continue;
       }
+      Cache::Reader const reader = cache.read(shard);
+      auto & misses = groups[shard];
+      misses.erase(remove_if(misses.begin(), misses.end(),
+        [&] (size_t const i) -> bool {
+          Cache::Entry const* const entry = reader.find(keys[i]);
+          if (entry != nullptr) {
+            strategies[shard].onAccess(*entry);
+            metrics.count(Metrics::Event::CacheHits);
+            values[i] = unpack(*entry);
+            return true;
+          }
+          if ((!staging || !staging->holds(keys[i])) &&
+              !disk.may_contain(keys[i])) {
+            metrics.count(Metrics::Event::CacheMisses);
+            metrics.count(Metrics::Event::DiskMisses);
+            return true;
+          }
+          return false;
+        }), misses.end());
+      missed = missed || !misses.empty();
+    }
+    if (!missed) {
+      return values;
+    }
+    /* a key asked for more than once is looked up once, taking it from the
+       staging buffer a second time would find nothing */
+    vector<pair<size_t, size_t>> repeated;
+    for (auto & misses : groups) {
+      unordered_map<string_view, size_t> first;
+      misses.erase(remove_if(misses.begin(), misses.end(),
+        [&] (size_t const i) -> bool {
+          auto const [it, inserted] = first.try_emplace(keys[i], i);
+          if (!inserted) {
+            repeated.emplace_back(i, it->second);
+          }
+          return !inserted;
+        }), misses.end());
     }
+
+    /* everything is looked up before anything is promoted, so that the
+       promotions of the batch cannot evict keys still to be looked up */
+    auto writers = lock(groups);
+    vector<size_t> promoted;
+    vector<bool> on_disk(keys.size(), false);
+    vector<string> disk_keys;
+    vector<size_t> disk_positions;
+    for (size_t shard = 0; shard < groups.size(); shard++) {
+      for (auto const i : groups[shard]) {
+        // another thread may have promoted the key in the meantime
+        Cache::Entry const* const entry = writers[shard]->find(keys[i]);
+        if (entry != nullptr) {
+          strategies[shard].onAccess(*entry);
+          metrics.count(Metrics::Event::CacheHits);
+          values[i] = unpack(*entry);
+          continue;
+        }
+        metrics.count(Metrics::Event::CacheMisses);
+        string owned_key{keys[i]};
+        if (staging) {
+          values[i] = staging->take(owned_key);
+          if (values[i]) {
+            metrics.count(Metrics::Event::StagingHits);
+            promoted.push_back(i);
+            continue;
+          }
+          if (staging->superseded(keys[i])) {
+            metrics.count(Metrics::Event::DiskMisses);
+            continue;
+          }
+        }
+        disk_keys.push_back(move(owned_key));
+        disk_positions.push_back(i);
+      }
+    }
+    if (!disk_keys.empty()) {
+      vector<optional<string>> disk_values;
+      {
+        Metrics::Timer const timer(metrics, Metrics::Latency::DiskRead);
+        disk_values = disk.get(disk_keys);
+      }
+      size_t found{0};
+      for (size_t j = 0; j < disk_keys.size(); j++) {
+        if (disk_values[j].has_value()) {
+          size_t const i = disk_positions[j];
+          values[i] = writers[cache.shard(keys[i])]->make_value(
+            move(disk_values[j].value()));
+          promoted.push_back(i);
+          on_disk[i] = true;
+          ++found;
+        }
+      }
+      metrics.count(Metrics::Event::DiskHits, found);
+      metrics.count(Metrics::Event::DiskMisses, disk_keys.size() - found);
+    }
+    Records victims;
+    Evicted evicted;
+    vector<string> cached;
+    for (auto const i : promoted) {
+      size_t const shard = cache.shard(keys[i]);
+      auto const [stored, compressed] = pack(*writers[shard], values[i]);
+      bool const placed = place(*writers[shard], strategies[shard], keys[i],
+                                stored, compressed, victims, evicted);
+      // a value too large for its shard stays on the disk or goes back there
+      if (placed && on_disk[i]) {
+        cached.emplace_back(keys[i]);
+      } else if (!placed && !on_disk[i]) {
+        victims.emplace_back(string{keys[i]}, values[i]);
+      }
+    }
+    // before the victims, one of them may be a key promoted just now
+    if (!cached.empty()) {
+      disk.del(cached);
+    }
+    spill(move(victims));
+    for (auto const& [i, first] : repeated) {
+      values[i] = values[first];
+    }
+    return values;
   }
 
-  bool del(string const& key) {
-    if (cache.del(key)) {
-      strategy.onDelete(key);
+  // runs "visitor" on the value without copying it out of the store
+  template<typename Visitor>
+  bool retrieve_with(string_view const key, Visitor && visitor) {
+    shared_ptr<string const> const value = retrieve_shared(key);
+    if (value) {
+      visitor(string_view{*value});
       return true;
-    } else {
-      return false;
+    }
+    return false;
+  }
+
+  bool del(string_view const key) {
+    Metrics::Timer const timer(metrics, Metrics::Latency::Delete);
+    size_t const shard = cache.shard(key);
+    {
+      Cache::Writer writer = cache.write(shard);
+      Cache::Entry const* const entry = writer.find(key);
+      if (entry == nullptr) {
+        return false;
+      }
+      // the entry leaves the eviction order before its node is freed
+      strategies[shard].onDelete(*entry);
+      writer.take(key);
+      metrics.count(Metrics::Event::Deletes);
+    }
+    // after the shard is unlocked, checkpoint() holds the journal's lock
+    journal_deleted({key});
+    return true;
+  }
+
+  // whether each of "keys" was in the cache, in their order
+  vector<bool> del_many(vector<string_view> const& keys) {
+    vector<bool> deleted(keys.size(), false);
+    auto const groups = group(keys);
+    auto writers = lock(groups);
+    for (size_t shard = 0; shard < groups.size(); shard++) {
+      for (auto const i : groups[shard]) {
+        Cache::Writer & writer = *writers[shard];
+        Cache::Entry const* const entry = writer.find(keys[i]);
+        if (entry != nullptr) {
+          strategies[shard].onDelete(*entry);
+          writer.take(keys[i]);
+          metrics.count(Metrics::Event::Deletes);
+          deleted[i] = true;
+        }
+      }
+    }
+    writers.clear();
+    vector<string_view> journaled;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (deleted[i]) {
+        journaled.push_back(keys[i]);
+      }
+    }
+    journal_deleted(journaled);
+    return deleted;
+  }
+
+  // totals of all threads, with the current sizes of the cache and the disk
+  Metrics::Stats stats() {
+    Metrics::Stats stats = metrics.stats();
+    stats.cache_bytes = cache.size();
+    stats.disk_bytes = disk.size();
+    return stats;
+  }
+
+  /* writes every cached record with the strategy's state of it, shard by
+     shard, and replaces the previous snapshot once the new one is complete;
+     deletions wait for it and go to a new journal, a crash before that is
+     started leaves the previous one behind, which restore() ignores */
+  void checkpoint() {
+    lock_guard<std::mutex> journal_lock(deleted_mutex);
+    string const temp{filename_snapshot + ".tmp"};
+    ofstream stream(temp, ios::binary | ios::trunc);
+    if (stream.fail()) {
+      throw ios::failure("Error writing snapshot");
+    }
+    stream.write(snapshot_magic, sizeof(snapshot_magic));
+    write_number(stream, generation + 1);
+    streampos const count_position = stream.tellp();
+    write_number(stream, 0);
+    uint64_t records{0};
+    for (size_t shard = 0; shard < cache.shard_count(); shard++) {
+      // the entries stay put while the shard is read-locked
+      Cache::Reader const reader = cache.read(shard);
+      strategies[shard].save(
+        [&stream, &records] (Hook const& hook, size_t const state) -> void {
+          auto const& entry = static_cast<Cache::Entry const&>(hook);
+          // compressed again when the snapshot is restored
+          auto const value = entry.plain();
+          write_number(stream, state);
+          write_number(stream, entry.key.length());
+          stream.write(entry.key.data(),
+                       static_cast<streamsize>(entry.key.length()));
+          write_number(stream, value->length());
+          stream.write(value->data(),
+                       static_cast<streamsize>(value->length()));
+          ++records;
+        });
+    }
+    stream.seekp(count_position);
+    write_number(stream, records);
+    stream.close();
+    if (stream.fail()) {
+      remove(temp.c_str());
+      throw ios::failure("Error writing snapshot");
+    }
+    rename(temp.c_str(), filename_snapshot.c_str());
+    ++generation;
+    deleted_journal.close();
+    deleted_journal.clear();
+    deleted_journal.open(filename_deleted, ios::binary | ios::trunc);
+    deleted_journal.write(deleted_magic, sizeof(deleted_magic));
+    write_number(deleted_journal, generation);
+    deleted_journal.flush();
+    if (deleted_journal.fail()) {
+      // without the journal a deleted key could come back
+      deleted_journal.close();
+      remove(filename_snapshot.c_str());
+      throw ios::failure("Error writing snapshot");
     }
   }
 
+  // used for interactive demonstration
+  void printStats() {
+    stats().printAll();
+  }
+
   // used for interactive demonstration
   void delAll() {
+    for (size_t i = 0; i < cache.shard_count(); i++) {
+      strategies[i].delAll();
+    }
     cache.delAll();
-    strategy.delAll();
+    if (staging) {
+      staging->delAll();
+    }
     disk.delAll();
+    {
+      lock_guard<std::mutex> lock(deleted_mutex);
+      deleted_journal.close();
+    }
+    remove(filename_snapshot.c_str());
+    remove(filename_deleted.c_str());
   }
   // used for interactive demonstration
   void printAll() {
     cout << "Cache(" << cache.size() <<") contents:" << endl;
     cache.printAll();
     cout << "Strategy contents:" << endl;
-    strategy.printAll();
+    for (size_t i = 0; i < cache.shard_count(); i++) {
+      strategies[i].printAll();
+    }
+    if (staging) {
+      cout << "Staging(" << staging->size() << ") contents:" << endl;
+      staging->printAll();
+    }
     cout << "Disk contents:" << endl;
     disk.printAll();
   }
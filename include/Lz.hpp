@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+/* byte-oriented LZ77 codec in the style of LZ4: the uncompressed length
+   (32-bit little endian), then sequences of a token, literals and a match;
+   the token holds the number of literals in its high and the match length
+   minus 4 in its low nibble, 15 continuing in bytes of up to 255 each, the
+   match is copied from up to 65535 bytes back, the last sequence has only
+   literals; fast to decode and good on repetitive text like JSON */
+class Lz final {
+ private:
+  static constexpr size_t min_match{4};
+  static constexpr size_t max_offset{65535};
+  static constexpr size_t hash_bits{13};
+
+  static uint32_t read32(char const* const bytes) {
+    uint32_t number;
+    memcpy(&number, bytes, sizeof(number));
+    return number;
+  }
+
+  static size_t hash(uint32_t const sequence) {
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+  }
+
+  static void put_length(string & output, size_t length) {
+    for (; length >= 255; length -= 255) {
+      output.push_back(static_cast<char>(255));
+    }
+    output.push_back(static_cast<char>(length));
+  }
+
+  // adds the continuation bytes of a nibble that reached 15
+  static bool get_length(string_view const input, size_t & position,
+                         size_t & length) {
+    if (length < 15) {
+      return true;
+    }
+    while (position < input.length()) {
+      auto const byte = static_cast<unsigned char>(input[position++]);
+      length += byte;
+      if (byte < 255) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void put_sequence(string & output, string_view const literals,
+                           size_t const offset, size_t const match) {
+    size_t const literal_nibble = min<size_t>(literals.length(), 15);
+    size_t const match_nibble = match == 0
+      ? 0 : min<size_t>(match - min_match, 15);
+    output.push_back(static_cast<char>((literal_nibble << 4) | match_nibble));
+    if (literal_nibble == 15) {
+      put_length(output, literals.length() - 15);
+    }
+    output.append(literals);
+    if (match == 0) {
+      return;
+    }
+    output.push_back(static_cast<char>(offset & 0xFF));
+    output.push_back(static_cast<char>(offset >> 8));
+    if (match_nibble == 15) {
+      put_length(output, match - min_match - 15);
+    }
+  }
+
+ public:
+  static string compress(string_view const input) {
+    string output;
+    output.reserve(input.length() / 2 + 16);
+    for (size_t i = 0; i < 4; i++) {
+      output.push_back(static_cast<char>((input.length() >> (8 * i)) & 0xFF));
+    }
+    // last position + 1 of every hashed sequence, 0 for none
+    array<uint32_t, size_t{1} << hash_bits> table{};
+    char const* const data = input.data();
+    size_t anchor{0};
+    size_t position{0};
+    while (input.length() >= min_match &&
+           position <= input.length() - min_match) {
+      uint32_t const sequence = read32(data + position);
+      uint32_t & slot = table[hash(sequence)];
+      size_t const candidate = slot;
+      slot = static_cast<uint32_t>(position + 1);
+      if (candidate == 0 || position - (candidate - 1) > max_offset ||
+          read32(data + candidate - 1) != sequence) {
+        position++;
+        continue;
+      }
+      size_t const from = candidate - 1;
+      size_t match{min_match};
+      while (position + match < input.length() &&
+             data[from + match] == data[position + match]) {
+        match++;
+      }
+      put_sequence(output, input.substr(anchor, position - anchor),
+                   position - from, match);
+      position += match;
+      anchor = position;
+    }
+    put_sequence(output, input.substr(anchor), 0, 0);
+    return output;
+  }
+
+  // nullopt if "input" was not made by compress()
+  static optional<string> decompress(string_view const input) {
+    if (input.length() < 4) {
+      return nullopt;
+    }
+    size_t length{0};
+    for (size_t i = 0; i < 4; i++) {
+      length |= static_cast<size_t>(static_cast<unsigned char>(input[i]))
+                << (8 * i);
+    }
+    string output;
+    output.reserve(length);
+    size_t position{4};
+    while (position < input.length()) {
+      auto const token = static_cast<unsigned char>(input[position++]);
+      size_t literals = token >> 4;
+      if (!get_length(input, position, literals) ||
+          input.length() - position < literals ||
+          length - output.length() < literals) {
+        return nullopt;
+      }
+      output.append(input.substr(position, literals));
+      position += literals;
+      if (position == input.length()) {
+        break;
+      }
+      if (input.length() - position < 2) {
+        return nullopt;
+      }
+      size_t const offset =
+        static_cast<size_t>(static_cast<unsigned char>(input[position])) |
+        static_cast<size_t>(static_cast<unsigned char>(input[position+1]))
+          << 8;
+      position += 2;
+      size_t match = token & 0x0F;
+      if (!get_length(input, position, match)) {
+        return nullopt;
+      }
+      match += min_match;
+      if (offset == 0 || offset > output.length() ||
+          length - output.length() < match) {
+        return nullopt;
+      }
+      // byte by byte where the match overlaps the bytes it produces
+      size_t const from = output.length() - offset;
+      if (offset >= match) {
+        output.append(output, from, match);
+      } else {
+        for (size_t i = 0; i < match; i++) {
+          output.push_back(output[from + i]);
+        }
+      }
+    }
+    if (output.length() != length) {
+      return nullopt;
+    }
+    return output;
+  }
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <Histogram.hpp>
+
+using namespace std;
+
+// -DKVS_DISABLE_METRICS compiles every counter and timer away
+#ifdef KVS_DISABLE_METRICS
+constexpr bool metrics_enabled{false};
+#else
+constexpr bool metrics_enabled{true};
+#endif
+
+/* counters and latency histograms kept per thread: a thread only ever
+   writes its own, with plain stores to relaxed atomics, and stats() sums
+   them up, so that the hot path shares no written cache line */
+class Metrics final {
+ public:
+  /* "Compressions" counts values kept compressed in the cache, with their
+     bytes before and after, "*Nanos" the time spent on compressing values
+     and on decompressing them again */
+  enum class Event {
+    CacheHits, CacheMisses, StagingHits, DiskHits, DiskMisses, Evictions,
+    EvictedBytes, Records, Deletes, Compressions, CompressionInput,
+    CompressionOutput, CompressionNanos, Decompressions, DecompressionNanos
+  };
+  // "Retrieve*" is told apart by the tier that answered
+  enum class Latency {
+    Record, RetrieveCache, RetrieveDisk, RetrieveMiss, Delete, DiskRead,
+    DiskWrite
+  };
+
+  static constexpr size_t number_of_events{15};
+  static constexpr size_t number_of_latencies{7};
+
+  // totals over all threads at the time of the call
+  struct Stats {
+    array<uint64_t, number_of_events> events{};
+    array<Histogram, number_of_latencies> latencies{};
+    size_t cache_bytes{0};
+    size_t disk_bytes{0};
+
+    uint64_t operator[](Event const event) const {
+      return events[static_cast<size_t>(event)];
+    }
+    Histogram const& operator[](Latency const latency) const {
+      return latencies[static_cast<size_t>(latency)];
+    }
+
+    // hits among all lookups, hits in the staging buffer count as disk hits
+    double cache_hit_ratio() const {
+      uint64_t const lookups = (*this)[Event::CacheHits] +
+                               (*this)[Event::CacheMisses];
+      return lookups == 0 ? 0.0
+        : static_cast<double>((*this)[Event::CacheHits]) / lookups;
+    }
+    // hits among the lookups the cache missed
+    double disk_hit_ratio() const {
+      uint64_t const hits = (*this)[Event::StagingHits] +
+                            (*this)[Event::DiskHits];
+      uint64_t const lookups = hits + (*this)[Event::DiskMisses];
+      return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+    }
+    // bytes of the values compressed per byte kept of them
+    double compression_ratio() const {
+      uint64_t const output = (*this)[Event::CompressionOutput];
+      return output == 0 ? 0.0
+        : static_cast<double>((*this)[Event::CompressionInput]) / output;
+    }
+
+    // used for interactive demonstration
+    void printAll() const {
+      static char const* const event_names[number_of_events] = {
+        "cache hits", "cache misses", "staging hits", "disk hits",
+        "disk misses", "evictions", "evicted bytes", "records", "deletes",
+        "compressions", "compression input bytes", "compression output bytes",
+        "compression ns", "decompressions", "decompression ns"};
+      static char const* const latency_names[number_of_latencies] = {
+        "record", "retrieve (cache)", "retrieve (disk)", "retrieve (miss)",
+        "delete", "disk read", "disk write"};
+      if (!metrics_enabled) {
+        cout << "Metrics are disabled" << endl;
+        return;
+      }
+      for (size_t i = 0; i < number_of_events; i++) {
+        cout << event_names[i] << ": " << events[i] << endl;
+      }
+      cout << "cache hit ratio: " << cache_hit_ratio() << endl
+           << "disk hit ratio: " << disk_hit_ratio() << endl
+           << "compression ratio: " << compression_ratio() << endl
+           << "cache bytes: " << cache_bytes << endl
+           << "disk bytes: " << disk_bytes << endl;
+      for (size_t i = 0; i < number_of_latencies; i++) {
+        cout << latency_names[i] << ": " << latencies[i].count()
+             << " ops, p50 " << latencies[i].percentile(0.5)
+             << " ns, p99 " << latencies[i].percentile(0.99) << " ns" << endl;
+      }
+    }
+  };
+
+ private:
+  // written by its thread only, read by stats()
+  struct alignas(64) Local {
+    array<atomic<uint64_t>, number_of_events> events{};
+    array<array<atomic<uint64_t>, Histogram::number_of_buckets>,
+          number_of_latencies> latencies{};
+  };
+
+  // identifies the instance to the threads, addresses may be reused
+  uint64_t const id;
+  vector<unique_ptr<Local>> locals;
+  std::mutex locals_mutex;
+
+  static uint64_t next_id() {
+    static atomic<uint64_t> id{1};
+    return id++;
+  }
+
+  static void add(atomic<uint64_t> & counter, uint64_t const amount) {
+    counter.store(counter.load(memory_order_relaxed) + amount,
+                  memory_order_relaxed);
+  }
+
+  /* the calling thread's counters, registered on its first use of this
+     instance; they outlive the thread, so that its counts are kept */
+  Local & local() {
+    thread_local uint64_t cached_id{0};
+    thread_local Local* cached{nullptr};
+    if (cached_id == id) {
+      return *cached;
+    }
+    thread_local unordered_map<uint64_t, Local*> registered;
+    Local* & found = registered[id];
+    if (found == nullptr) {
+      lock_guard<std::mutex> lock(locals_mutex);
+      locals.push_back(make_unique<Local>());
+      found = locals.back().get();
+    }
+    cached_id = id;
+    cached = found;
+    return *found;
+  }
+
+ public:
+  Metrics() : id(next_id()) {}
+  ~Metrics() = default;
+  Metrics(Metrics const&) = delete;
+  Metrics(Metrics &&) noexcept = delete;
+  Metrics &operator=(Metrics const&) = delete;
+  Metrics &operator=(Metrics &&) noexcept = delete;
+
+  void count(Event const event, uint64_t const amount = 1) {
+    if constexpr (metrics_enabled) {
+      add(local().events[static_cast<size_t>(event)], amount);
+    }
+  }
+
+  void record(Latency const latency, uint64_t const nanoseconds) {
+    if constexpr (metrics_enabled) {
+      add(local().latencies[static_cast<size_t>(latency)]
+                           [Histogram::bucket(nanoseconds)], 1);
+    }
+  }
+
+  // measures its own lifetime, the latency may be picked on the way
+  class Timer final {
+   private:
+    Metrics & metrics;
+    Latency latency;
+    chrono::steady_clock::time_point const start;
+    bool discarded{false};
+
+   public:
+    Timer(Metrics & metrics, Latency const latency)
+      : metrics(metrics),
+        latency(latency),
+        start(metrics_enabled ? chrono::steady_clock::now()
+                              : chrono::steady_clock::time_point{}) {}
+    ~Timer() {
+      if (metrics_enabled && !discarded) {
+        auto const elapsed = chrono::steady_clock::now() - start;
+        metrics.record(latency, static_cast<uint64_t>(
+          chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+      }
+    }
+    Timer(Timer const&) = delete;
+    Timer(Timer &&) noexcept = delete;
+    Timer &operator=(Timer const&) = delete;
+    Timer &operator=(Timer &&) noexcept = delete;
+
+    void set(Latency const latency) noexcept {
+      this->latency = latency;
+    }
+    // the operation is timed elsewhere, nothing is recorded
+    void discard() noexcept {
+      discarded = true;
+    }
+  };
+
+  // adds the nanoseconds of its lifetime to an event
+  class Stopwatch final {
+   private:
+    Metrics & metrics;
+    Event const event;
+    chrono::steady_clock::time_point const start;
+
+   public:
+    Stopwatch(Metrics & metrics, Event const event)
+      : metrics(metrics),
+        event(event),
+        start(metrics_enabled ? chrono::steady_clock::now()
+                              : chrono::steady_clock::time_point{}) {}
+    ~Stopwatch() {
+      if constexpr (metrics_enabled) {
+        auto const elapsed = chrono::steady_clock::now() - start;
+        metrics.count(event, static_cast<uint64_t>(
+          chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+      }
+    }
+    Stopwatch(Stopwatch const&) = delete;
+    Stopwatch(Stopwatch &&) noexcept = delete;
+    Stopwatch &operator=(Stopwatch const&) = delete;
+    Stopwatch &operator=(Stopwatch &&) noexcept = delete;
+  };
+
+  Stats stats() {
+    Stats stats;
+    if constexpr (metrics_enabled) {
+      lock_guard<std::mutex> lock(locals_mutex);
+      for (auto const& local : locals) {
+        for (size_t i = 0; i < number_of_events; i++) {
+          stats.events[i] += local->events[i].load(memory_order_relaxed);
+        }
+        for (size_t i = 0; i < number_of_latencies; i++) {
+          for (size_t bucket = 0; bucket < Histogram::number_of_buckets;
+               bucket++) {
+            uint64_t const count =
+              local->latencies[i][bucket].load(memory_order_relaxed);
+            if (count > 0) {
+              stats.latencies[i].add(bucket, count);
+            }
+          }
+        }
+      }
+    }
+    return stats;
+  }
+};
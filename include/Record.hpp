@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+using namespace std;
+
+// CRC-32C (Castagnoli), table driven
+class Crc32c final {
+ private:
+  static array<uint32_t, 256> const& table() {
+    static array<uint32_t, 256> const table = [] () -> array<uint32_t, 256> {
+      array<uint32_t, 256> table{};
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (size_t bit = 0; bit < 8; bit++) {
+          crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+        }
+        table[i] = crc;
+      }
+      return table;
+    }();
+    return table;
+  }
+
+ public:
+  // continues "crc" over "bytes", start with 0
+  static uint32_t extend(uint32_t crc, string_view const bytes) {
+    auto const& lookup = table();
+    crc = ~crc;
+    for (unsigned char const byte : bytes) {
+      crc = lookup[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+};
+
+/* header in front of the key and value bytes of every record on the disk:
+   key length and value length (32-bit little endian), flags, and a CRC-32C
+   of the preceding header bytes, the key and the value; a reader skips a
+   record by its lengths and recognizes a torn one by its checksum */
+struct RecordHeader {
+  static constexpr size_t size{13};
+  // the record deletes its key, its value is empty
+  static constexpr uint8_t tombstone{1};
+  // the record's value is a compressed run of records, its key is empty
+  static constexpr uint8_t block{2};
+
+  // the longest key or value a header can describe
+  static constexpr size_t max_length{UINT32_MAX};
+
+  uint32_t key_length{0};
+  uint32_t value_length{0};
+  uint8_t flags{0};
+  uint32_t checksum{0};
+
+  static bool fits(size_t const key_length, size_t const value_length) {
+    return key_length <= max_length && value_length <= max_length;
+  }
+
+  static void put32(char* const bytes, uint32_t const number) {
+    for (size_t i = 0; i < 4; i++) {
+      bytes[i] = static_cast<char>((number >> (8 * i)) & 0xFF);
+    }
+  }
+
+  static uint32_t get32(char const* const bytes) {
+    uint32_t number{0};
+    for (size_t i = 0; i < 4; i++) {
+      number |= static_cast<uint32_t>(static_cast<unsigned char>(bytes[i]))
+                << (8 * i);
+    }
+    return number;
+  }
+
+  // the checksum of the record made of this header, "key" and "value"
+  uint32_t sum(string_view const key, string_view const value) const {
+    char fields[9];
+    put32(fields, key_length);
+    put32(fields + 4, value_length);
+    fields[8] = static_cast<char>(flags);
+    return Crc32c::extend(Crc32c::extend(
+      Crc32c::extend(0, string_view{fields, sizeof(fields)}), key), value);
+  }
+
+  static RecordHeader of(uint8_t const flags, string_view const key,
+                         string_view const value) {
+    RecordHeader header{static_cast<uint32_t>(key.length()),
+                        static_cast<uint32_t>(value.length()), flags, 0};
+    header.checksum = header.sum(key, value);
+    return header;
+  }
+
+  static RecordHeader decode(char const* const bytes) {
+    return RecordHeader{get32(bytes), get32(bytes + 4),
+                        static_cast<uint8_t>(bytes[8]), get32(bytes + 9)};
+  }
+
+  array<char, size> encode() const {
+    array<char, size> bytes;
+    put32(bytes.data(), key_length);
+    put32(bytes.data() + 4, value_length);
+    bytes[8] = static_cast<char>(flags);
+    put32(bytes.data() + 9, checksum);
+    return bytes;
+  }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/* count-min sketch of how often keys were seen, in 4 rows of 4-bit
+   counters; every "sample" increments all counters are halved, so that
+   the history of keys fades out instead of pinning them forever */
+class FrequencySketch final {
+ private:
+  static constexpr size_t number_of_rows{4};
+  static constexpr uint8_t saturated{15};
+
+  // counters of row r are the nibbles at r * width .. (r + 1) * width - 1
+  vector<uint8_t> counters;
+  size_t width;
+  size_t sample;
+  size_t increments{0};
+
+  static uint64_t mix(uint64_t hash) {
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+  }
+
+  uint8_t counter(size_t const i) const {
+    return (counters[i >> 1] >> ((i & 1) << 2)) & 0x0F;
+  }
+
+  void set_counter(size_t const i, uint8_t const value) {
+    uint8_t const shift = static_cast<uint8_t>((i & 1) << 2);
+    counters[i >> 1] = static_cast<uint8_t>(
+      (counters[i >> 1] & ~(0x0F << shift)) | (value << shift));
+  }
+
+  template<typename Visitor>
+  void probe(string_view const key, Visitor && visitor) const {
+    uint64_t const h1 = hash<string_view>{}(key);
+    uint64_t const h2 = mix(h1) | 1;
+    for (size_t row = 0; row < number_of_rows; row++) {
+      visitor(row * width + static_cast<size_t>((h1 + row * h2) % width));
+    }
+  }
+
+ public:
+  // "width" counters per row, halved after 10 increments per counter
+  explicit FrequencySketch(size_t const width = 1024)
+    : counters((max<size_t>(width, 1) * number_of_rows + 1) / 2),
+      width(max<size_t>(width, 1)),
+      sample(max<size_t>(width, 1) * 10) {}
+
+  void increment(string_view const key) {
+    // conservative update: only the smallest counters grow
+    uint8_t const current = frequency(key);
+    if (current < saturated) {
+      probe(key, [this, current] (size_t const i) -> void {
+        if (counter(i) == current) {
+          set_counter(i, static_cast<uint8_t>(current + 1));
+        }
+      });
+    }
+    if (++increments >= sample) {
+      age();
+    }
+  }
+
+  uint8_t frequency(string_view const key) const {
+    uint8_t minimum{saturated};
+    probe(key, [this, &minimum] (size_t const i) -> void {
+      minimum = min(minimum, counter(i));
+    });
+    return minimum;
+  }
+
+  // halves every counter
+  void age() {
+    for (auto & nibbles : counters) {
+      nibbles = static_cast<uint8_t>((nibbles >> 1) & 0x77);
+    }
+    increments /= 2;
+  }
+
+  /* doubles the width and keeps every estimate: a key's counter at column
+     h % (2 * width) of a row is the one at h % width before */
+  void grow() {
+    FrequencySketch wider(width * 2);
+    for (size_t row = 0; row < number_of_rows; row++) {
+      for (size_t column = 0; column < wider.width; column++) {
+        wider.set_counter(row * wider.width + column,
+                          counter(row * width + column % width));
+      }
+    }
+    wider.increments = increments;
+    *this = move(wider);
+  }
+
+  size_t capacity() const noexcept {
+    return width;
+  }
+
+  size_t memory() const noexcept {
+    return counters.size();
+  }
+
+  void clear() {
+    fill(counters.begin(), counters.end(), 0);
+    increments = 0;
+  }
+};
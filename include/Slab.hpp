@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+/* size-classed slab allocator: requests are rounded up to one of 40 chunk
+   sizes (16-byte steps up to 128 bytes, then four steps per power of two up
+   to 32 KiB), chunks of a size class are carved out of 64 KiB slabs and
+   recycled through a free list; larger requests go to the system as is */
+class Slab final {
+ private:
+  static constexpr size_t slab_bytes{64 << 10};
+  static constexpr size_t largest_chunk{32 << 10};
+  static constexpr size_t number_of_classes{40};
+
+  struct Free {
+    Free* next;
+  };
+
+  struct SizeClass {
+    Free* free_list{nullptr};
+    char* cursor{nullptr};
+    char* limit{nullptr};
+  };
+
+  array<SizeClass, number_of_classes> classes{};
+  vector<unique_ptr<char[]>> slabs;
+  size_t bytes_in_use{0};
+  size_t bytes_reserved{0};
+  std::mutex mutex;
+
+  static size_t msb(size_t const value) {
+    return 63 - static_cast<size_t>(__builtin_clzll(value));
+  }
+
+  static size_t class_of(size_t const bytes) {
+    if (bytes <= 128) {
+      return bytes == 0 ? 0 : (bytes - 1) / 16;
+    }
+    size_t const shift = msb(bytes - 1) - 2;
+    return 8 + (shift - 5) * 4 + ((bytes - 1) >> shift) - 4;
+  }
+
+ public:
+  Slab() = default;
+  Slab(Slab const&) = delete;
+  Slab(Slab &&) noexcept = delete;
+  Slab &operator=(Slab const&) = delete;
+  Slab &operator=(Slab &&) noexcept = delete;
+
+  // bytes a request of "bytes" occupies
+  static size_t chunk_size(size_t const bytes) {
+    if (bytes > largest_chunk) {
+      return bytes;
+    } else if (bytes <= 128) {
+      return bytes == 0 ? 16 : (bytes + 15) / 16 * 16;
+    }
+    size_t const shift = msb(bytes - 1) - 2;
+    return (((bytes - 1) >> shift) + 1) << shift;
+  }
+
+  void* allocate(size_t const bytes) {
+    size_t const chunk = chunk_size(bytes);
+    if (chunk > largest_chunk) {
+      void* const pointer = ::operator new(chunk);
+      lock_guard<std::mutex> lock(mutex);
+      bytes_in_use += chunk;
+      bytes_reserved += chunk;
+      return pointer;
+    }
+    lock_guard<std::mutex> lock(mutex);
+    SizeClass & size_class = classes[class_of(bytes)];
+    bytes_in_use += chunk;
+    if (size_class.free_list != nullptr) {
+      Free* const free = size_class.free_list;
+      size_class.free_list = free->next;
+      return free;
+    }
+    if (size_class.cursor == size_class.limit) {
+      slabs.push_back(make_unique<char[]>(slab_bytes));
+      bytes_reserved += slab_bytes;
+      size_class.cursor = slabs.back().get();
+      size_class.limit = size_class.cursor + slab_bytes / chunk * chunk;
+    }
+    void* const pointer = size_class.cursor;
+    size_class.cursor += chunk;
+    return pointer;
+  }
+
+  void deallocate(void* const pointer, size_t const bytes) noexcept {
+    size_t const chunk = chunk_size(bytes);
+    if (chunk > largest_chunk) {
+      ::operator delete(pointer);
+      lock_guard<std::mutex> lock(mutex);
+      bytes_in_use -= chunk;
+      bytes_reserved -= chunk;
+      return;
+    }
+    lock_guard<std::mutex> lock(mutex);
+    SizeClass & size_class = classes[class_of(bytes)];
+    size_class.free_list = new (pointer) Free{size_class.free_list};
+    bytes_in_use -= chunk;
+  }
+
+  // bytes of chunks currently handed out
+  size_t in_use() {
+    lock_guard<std::mutex> lock(mutex);
+    return bytes_in_use;
+  }
+
+  // bytes taken from the system, slabs are kept until the allocator dies
+  size_t reserved() {
+    lock_guard<std::mutex> lock(mutex);
+    return bytes_reserved;
+  }
+};
+
+/* standard allocator over a shared Slab, or over operator new when there is
+   none; copies keep the slab alive, so that blocks released late (like a
+   shared value outliving its cache) still have somewhere to go */
+template<typename T>
+struct SlabAllocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = true_type;
+  using propagate_on_container_move_assignment = true_type;
+  using propagate_on_container_swap = true_type;
+
+  shared_ptr<Slab> slab;
+
+  SlabAllocator() noexcept = default;
+  explicit SlabAllocator(shared_ptr<Slab> slab) noexcept
+    : slab(move(slab)) {}
+  template<typename U>
+  SlabAllocator(SlabAllocator<U> const& other) noexcept
+    : slab(other.slab) {}
+
+  T* allocate(size_t const n) {
+    if (slab) {
+      return static_cast<T*>(slab->allocate(n * sizeof(T)));
+    } else {
+      return allocator<T>().allocate(n);
+    }
+  }
+
+  void deallocate(T* const pointer, size_t const n) noexcept {
+    if (slab) {
+      slab->deallocate(pointer, n * sizeof(T));
+    } else {
+      allocator<T>().deallocate(pointer, n);
+    }
+  }
+
+  template<typename U>
+  bool operator==(SlabAllocator<U> const& other) const noexcept {
+    return slab == other.slab;
+  }
+  template<typename U>
+  bool operator!=(SlabAllocator<U> const& other) const noexcept {
+    return slab != other.slab;
+  }
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <Disk.hpp>
+
+using namespace std;
+
+/* write-behind buffer between the cache and the disk: evicted records are
+   parked here and appended to the disk by a background thread */
+class Staging final {
+ private:
+  /* records in a list, whose nodes never move once linked, and a table of
+     views into their keys, so that lookups by string_view need no temporary
+     string; records move between lists without being copied */
+  class Records final {
+   private:
+    using List = list<pair<string const, shared_ptr<string const>>>;
+    List records;
+    unordered_map<string_view, List::iterator> index;
+
+   public:
+    using iterator = List::iterator;
+
+    iterator begin() noexcept {
+      return records.begin();
+    }
+    iterator end() noexcept {
+      return records.end();
+    }
+    List::const_iterator begin() const noexcept {
+      return records.begin();
+    }
+    List::const_iterator end() const noexcept {
+      return records.end();
+    }
+    bool empty() const noexcept {
+      return records.empty();
+    }
+    size_t size() const noexcept {
+      return records.size();
+    }
+
+    iterator find(string_view const key) {
+      auto const it = index.find(key);
+      return it == index.end() ? records.end() : it->second;
+    }
+
+    void emplace(string key, shared_ptr<string const> value) {
+      records.emplace_back(move(key), move(value));
+      index.emplace(records.back().first, prev(records.end()));
+    }
+
+    void erase(iterator const it) {
+      index.erase(it->first);
+      records.erase(it);
+    }
+
+    // moves the record at "it" over from "other"
+    void splice(Records & other, iterator const it) {
+      other.index.erase(it->first);
+      records.splice(records.end(), other.records, it);
+      index.emplace(it->first, it);
+    }
+
+    void swap(Records & other) noexcept {
+      records.swap(other.records);
+      index.swap(other.index);
+    }
+
+    void clear() noexcept {
+      index.clear();
+      records.clear();
+    }
+  };
+
+  Disk & disk;
+  size_t const high_water;
+
+  // records waiting for the next flush
+  Records pending;
+  // records being appended by the flusher, not modified until it is done
+  Records in_flight;
+  /* keys of in-flight records promoted back to the cache, deleted once
+     appended; their copies on the disk are stale until then */
+  unordered_set<string_view> cancelled;
+  size_t staged_bytes{0};
+  size_t in_flight_bytes{0};
+  bool stopping{false};
+
+  std::mutex mutex;
+  condition_variable flusher_wakeup;
+  condition_variable writers_wakeup;
+  thread flusher;
+
+  static size_t record_size(string_view const key,
+                            shared_ptr<string const> const& value) {
+    return key.length() + value->length();
+  }
+
+  void run_flusher() {
+    unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      flusher_wakeup.wait(lock, [this] () -> bool {
+        return stopping || !pending.empty();
+      });
+      if (pending.empty()) {
+        return;
+      }
+      in_flight.swap(pending);
+      in_flight_bytes = 0;
+      for (auto const& [key, value] : in_flight) {
+        in_flight_bytes += record_size(key, value);
+      }
+      lock.unlock();
+      bool appended{true};
+      try {
+        disk.put_all(in_flight);
+      } catch (ios::failure const&) {
+        appended = false;
+      }
+      lock.lock();
+      if (!appended) {
+        // records that were neither promoted nor staged again are retried
+        for (auto it = in_flight.begin(); it != in_flight.end();) {
+          auto const record = it++;
+          if (cancelled.erase(record->first) == 0 &&
+              pending.find(record->first) == pending.end()) {
+            pending.splice(in_flight, record);
+          } else {
+            staged_bytes -= record_size(record->first, record->second);
+          }
+        }
+        in_flight.clear();
+        in_flight_bytes = 0;
+        writers_wakeup.notify_all();
+        if (stopping) {
+          return;
+        }
+        flusher_wakeup.wait_for(lock, chrono::milliseconds(100));
+        continue;
+      }
+      // the promoted records own the keys that "cancelled" views
+      Records promoted;
+      for (auto const key : cancelled) {
+        promoted.splice(in_flight, in_flight.find(key));
+      }
+      in_flight.clear();
+      staged_bytes -= in_flight_bytes;
+      in_flight_bytes = 0;
+      lock.unlock();
+      for (auto const& [key, value] : promoted) {
+        disk.del(key);
+      }
+      lock.lock();
+      // nothing is cancelled while nothing is in flight
+      cancelled.clear();
+      writers_wakeup.notify_all();
+    }
+  }
+
+ public:
+  /* writers block in put() while "high_water" bytes of records are staged
+     and not yet on the disk */
+  explicit Staging(Disk & disk, size_t const high_water)
+    : disk(disk), high_water(high_water) {
+    flusher = thread(&Staging::run_flusher, this);
+  }
+  // everything staged is appended before the flusher stops
+  ~Staging() {
+    {
+      lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    flusher_wakeup.notify_one();
+    flusher.join();
+  }
+  Staging(Staging const&) = delete;
+  Staging(Staging &&) noexcept = delete;
+  Staging &operator=(Staging const&) = delete;
+  Staging &operator=(Staging &&) noexcept = delete;
+
+  void put(vector<pair<string, shared_ptr<string const>>> && records) {
+    unique_lock<std::mutex> lock(mutex);
+    writers_wakeup.wait(lock, [this] () -> bool {
+      return staged_bytes < high_water;
+    });
+    for (auto & [key, value] : records) {
+      size_t const size = record_size(key, value);
+      auto const it = pending.find(key);
+      if (it != pending.end()) {
+        staged_bytes -= record_size(it->first, it->second);
+        it->second = move(value);
+      } else {
+        pending.emplace(move(key), move(value));
+      }
+      staged_bytes += size;
+    }
+    flusher_wakeup.notify_one();
+  }
+
+  // removes a staged record so that it can be promoted back to the cache
+  shared_ptr<string const> take(string_view const key) {
+    lock_guard<std::mutex> lock(mutex);
+    auto const it = pending.find(key);
+    if (it != pending.end()) {
+      staged_bytes -= record_size(it->first, it->second);
+      shared_ptr<string const> value{move(it->second)};
+      pending.erase(it);
+      writers_wakeup.notify_all();
+      return value;
+    }
+    auto const flying = in_flight.find(key);
+    if (flying != in_flight.end() && cancelled.insert(flying->first).second) {
+      return flying->second;
+    }
+    return nullptr;
+  }
+
+  // whether "key" is staged and not yet taken back
+  bool holds(string_view const key) {
+    lock_guard<std::mutex> lock(mutex);
+    return pending.find(key) != pending.end() ||
+           (in_flight.find(key) != in_flight.end() &&
+            cancelled.count(key) == 0);
+  }
+
+  /* whether "key" was taken back while being appended and its copy on the
+     disk is not yet deleted; the disk must not be searched for it */
+  bool superseded(string_view const key) {
+    lock_guard<std::mutex> lock(mutex);
+    return cancelled.count(key) > 0;
+  }
+
+  size_t size() {
+    lock_guard<std::mutex> lock(mutex);
+    return staged_bytes;
+  }
+
+  // blocks until everything staged so far is on the disk
+  void drain() {
+    unique_lock<std::mutex> lock(mutex);
+    writers_wakeup.wait(lock, [this] () -> bool {
+      return pending.empty() && in_flight.empty();
+    });
+  }
+
+  // used for interactive demonstration
+  void delAll() {
+    unique_lock<std::mutex> lock(mutex);
+    for (auto const& [key, value] : pending) {
+      staged_bytes -= record_size(key, value);
+    }
+    pending.clear();
+    writers_wakeup.notify_all();
+    writers_wakeup.wait(lock, [this] () -> bool {
+      return in_flight.empty();
+    });
+  }
+
+  // used for interactive demonstration
+  void printAll() {
+    lock_guard<std::mutex> lock(mutex);
+    if (pending.empty() && in_flight.empty()) {
+      cout << "Staging is empty" << endl;
+    } else {
+      for (auto const& [key, value] : pending) {
+        cout << key << ':' << *value << endl;
+      }
+      for (auto const& [key, value] : in_flight) {
+        if (cancelled.count(key) == 0) {
+          cout << key << ':' << *value << endl;
+        }
+      }
+    }
+  }
+};
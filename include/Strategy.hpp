@@ -1,15 +1,25 @@
 #pragma once
 
+#include <iostream>
 #include <list>
-#include <map>
+#include <mutex>
 #include <algorithm>
 #include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <Hook.hpp>
+#include <Sketch.hpp>
 
 using namespace std;
 
+/* strategies order the cache entries through the hooks embedded in them:
+   recording links an entry, eviction unlinks the victim and returns it, so
+   that the caller can take it out of the cache by its key, or returns
+   nullptr when no entry is linked */
 class FIFO final {
  private:
-  list<string> fifo;
+  Chain fifo;
   shared_mutex mutex;
 
  public:
@@ -20,27 +30,49 @@ class FIFO final {
   FIFO &operator=(FIFO const&) = delete;
   FIFO &operator=(FIFO &&) noexcept = delete;
 
-  void onRecord(string const& key) {
+  void onRecord(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    fifo.emplace_front(key);
+    if (entry.owner == nullptr) {
+      fifo.push_front(entry);
+      entry.owner = &fifo;
+    }
   }
-  void onDelete(string const& key) {
+  void onDelete(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    fifo.remove(key);
+    if (entry.owner != nullptr) {
+      Chain::unlink(entry);
+      entry.owner = nullptr;
+    }
   }
-  void onAccess(string const& key) const noexcept {}
-  void onEviction(Cache & cache, Disk & disk) {
+  void onAccess(Hook const& entry) const noexcept {}
+  Hook const* onEviction() {
     unique_lock<shared_mutex> write_lock(mutex);
-    disk.put(fifo.back(), cache.get(fifo.back()).value());
-    cache.del(fifo.back());
-    fifo.pop_back();
+    if (fifo.empty()) {
+      return nullptr;
+    }
+    Hook const& victim = *fifo.back();
+    Chain::unlink(victim);
+    victim.owner = nullptr;
+    return &victim;
+  }
+
+  // visits the entries oldest first, the order onRestore() expects
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    fifo.visit_reverse([&visitor] (Hook const& entry) -> void {
+      visitor(entry, 0);
+    });
+  }
+  // links an entry passed to save()'s visitor as the newest one
+  void onRestore(Hook const& entry, size_t) {
+    onRecord(entry);
   }
 
   // used for interactive demonstration
   void printAll() {
     shared_lock<shared_mutex> read_lock(mutex);
-    for (auto const& item : fifo)
-      cout << item << endl;
+    fifo.visit([] (Hook const& entry) -> void { cout << entry.key << endl; });
   }
   // used for interactive demonstration
   void delAll() {
@@ -51,7 +83,7 @@ class FIFO final {
 
 class LRU final {
  private:
-  list<string> lru;
+  Chain lru;
   shared_mutex mutex;
 
  public:
@@ -62,30 +94,55 @@ class LRU final {
   LRU &operator=(LRU const&) = delete;
   LRU &operator=(LRU &&) noexcept = delete;
 
-  void onRecord(string const& key) {
+  void onRecord(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    lru.emplace_front(key);
+    if (entry.owner == nullptr) {
+      lru.push_front(entry);
+      entry.owner = &lru;
+    }
   }
-  void onDelete(string const& key) {
+  void onDelete(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    lru.remove(key);
+    if (entry.owner != nullptr) {
+      Chain::unlink(entry);
+      entry.owner = nullptr;
+    }
   }
-  void onAccess(string const& key) {
+  void onAccess(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    lru.splice(lru.begin(), lru, find(lru.begin(), lru.end(), key));
+    if (entry.owner != nullptr) {
+      Chain::unlink(entry);
+      lru.push_front(entry);
+    }
   }
-  void onEviction(Cache & cache, Disk & disk) {
+  Hook const* onEviction() {
     unique_lock<shared_mutex> write_lock(mutex);
-    disk.put(lru.back(), cache.get(lru.back()).value());
-    cache.del(lru.back());
-    lru.pop_back();
+    if (lru.empty()) {
+      return nullptr;
+    }
+    Hook const& victim = *lru.back();
+    Chain::unlink(victim);
+    victim.owner = nullptr;
+    return &victim;
+  }
+
+  // visits the entries oldest first, the order onRestore() expects
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    lru.visit_reverse([&visitor] (Hook const& entry) -> void {
+      visitor(entry, 0);
+    });
+  }
+  // links an entry passed to save()'s visitor as the newest one
+  void onRestore(Hook const& entry, size_t) {
+    onRecord(entry);
   }
 
   // used for interactive demonstration
   void printAll() {
     shared_lock<shared_mutex> read_lock(mutex);
-    for (auto const& item : lru)
-      cout << item << endl;
+    lru.visit([] (Hook const& entry) -> void { cout << entry.key << endl; });
   }
   // used for interactive demonstration
   void delAll() {
@@ -96,9 +153,35 @@ class LRU final {
 
 class LFU final {
  private:
-  multimap<size_t, string> lfu;
+  // entries accessed equally often, the earliest to reach "frequency" in front
+  struct Bucket {
+    size_t const frequency;
+    Chain entries;
+    list<Bucket>::iterator position;
+
+    explicit Bucket(size_t const frequency) : frequency(frequency) {}
+  };
+  // buckets in ascending order of frequency, empty buckets are dropped
+  list<Bucket> lfu;
   shared_mutex mutex;
 
+  list<Bucket>::iterator emplace(list<Bucket>::iterator const position,
+                                 size_t const frequency) {
+    auto const bucket = lfu.emplace(position, frequency);
+    bucket->position = bucket;
+    return bucket;
+  }
+
+  // the entry's bucket is dropped once it is empty
+  void unlink(Hook const& entry) {
+    Bucket & bucket = *static_cast<Bucket*>(entry.owner);
+    Chain::unlink(entry);
+    entry.owner = nullptr;
+    if (bucket.entries.empty()) {
+      lfu.erase(bucket.position);
+    }
+  }
+
  public:
   LFU() = default;
   ~LFU() = default;
@@ -107,28 +190,72 @@ class LFU final {
   LFU &operator=(LFU const&) = delete;
   LFU &operator=(LFU &&) noexcept = delete;
 
-  void onRecord(string const& key) {
+  void onRecord(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    lfu.emplace(0, key);
+    if (entry.owner == nullptr) {
+      if (lfu.empty() || lfu.front().frequency != 0) {
+        emplace(lfu.begin(), 0);
+      }
+      lfu.front().entries.push_back(entry);
+      entry.owner = &lfu.front();
+    }
   }
-  void onDelete(string const& key) {
+  void onDelete(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    lfu.erase(find_if(lfu.begin(), lfu.end(),
-      [&key] (auto const& item) -> bool { return item.second == key; }));
+    if (entry.owner != nullptr) {
+      unlink(entry);
+    }
   }
-  void onAccess(string const& key) {
+  void onAccess(Hook const& entry) {
     unique_lock<shared_mutex> write_lock(mutex);
-    auto const it = find_if(lfu.begin(), lfu.end(),
-      [&key] (auto const& item) -> bool { return item.second == key; });
-    auto const update = it->first+1;
-    lfu.erase(it);
-    lfu.emplace(update, key);
+    if (entry.owner != nullptr) {
+      auto const bucket = static_cast<Bucket*>(entry.owner)->position;
+      auto next = std::next(bucket);
+      if (next == lfu.end() || next->frequency != bucket->frequency+1) {
+        next = emplace(next, bucket->frequency+1);
+      }
+      unlink(entry);
+      next->entries.push_back(entry);
+      entry.owner = &*next;
+    }
   }
-  void onEviction(Cache & cache, Disk & disk) {
+  Hook const* onEviction() {
     unique_lock<shared_mutex> write_lock(mutex);
-    disk.put(lfu.begin()->second, cache.get(lfu.begin()->second).value());
-    cache.del(lfu.begin()->second);
-    lfu.erase(lfu.begin());
+    if (lfu.empty()) {
+      return nullptr;
+    }
+    Hook const& victim = *lfu.front().entries.front();
+    unlink(victim);
+    return &victim;
+  }
+
+  // visits the entries by ascending frequency, which is their state
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    for (auto const& bucket : lfu) {
+      bucket.entries.visit([&visitor, &bucket] (Hook const& entry) -> void {
+        visitor(entry, bucket.frequency);
+      });
+    }
+  }
+  // links an entry at the back of the bucket of frequency "state"
+  void onRestore(Hook const& entry, size_t const state) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    auto bucket = lfu.end();
+    while (bucket != lfu.begin() && std::prev(bucket)->frequency > state) {
+      --bucket;
+    }
+    if (bucket == lfu.begin() || std::prev(bucket)->frequency != state) {
+      bucket = emplace(bucket, state);
+    } else {
+      --bucket;
+    }
+    bucket->entries.push_back(entry);
+    entry.owner = &*bucket;
   }
 
   // used for interactive demonstration
@@ -137,8 +264,10 @@ class LFU final {
     if (lfu.empty()) {
       cout << "Strategy is empty" << endl;
     } else {
-      for_each(lfu.rbegin(), lfu.rend(), [] (auto const& item) -> void {
-        cout << item.first << ':' << item.second << endl;
+      for_each(lfu.rbegin(), lfu.rend(), [] (auto const& bucket) -> void {
+        bucket.entries.visit_reverse([&bucket] (Hook const& entry) -> void {
+          cout << bucket.frequency << ':' << entry.key << endl;
+        });
       });
     }
   }
@@ -148,3 +277,578 @@ class LFU final {
     lfu.clear();
   }
 };
+
+// keys recently evicted, remembered without their values, oldest in the back
+class Ghosts final {
+ private:
+  list<string> ghosts;
+  // keys are views into the nodes of "ghosts", which never move once linked
+  unordered_map<string_view, list<string>::iterator> index;
+
+ public:
+  size_t size() const noexcept {
+    return ghosts.size();
+  }
+
+  void push_front(string_view const key) {
+    ghosts.emplace_front(key);
+    index.emplace(ghosts.front(), ghosts.begin());
+  }
+
+  // forgets "key", returns whether it was remembered
+  bool erase(string_view const key) {
+    auto const it = index.find(key);
+    if (it == index.end()) {
+      return false;
+    }
+    auto const node = it->second;
+    index.erase(it);
+    ghosts.erase(node);
+    return true;
+  }
+
+  // forgets the oldest keys until at most "count" are left
+  void trim(size_t const count) {
+    while (ghosts.size() > count) {
+      index.erase(ghosts.back());
+      ghosts.pop_back();
+    }
+  }
+
+  void clear() {
+    index.clear();
+    ghosts.clear();
+  }
+
+  // used for interactive demonstration
+  void printAll(char const* const name) const {
+    for (auto const& key : ghosts)
+      cout << name << ':' << key << endl;
+  }
+};
+
+/* Adaptive Replacement Cache (Megiddo and Modha): "t1" holds entries seen
+   once, "t2" entries seen again, "b1" and "b2" the keys last evicted from
+   either; a recorded key found in "b1" makes room for recency (raises the
+   target size "p" of "t1"), one found in "b2" for frequency. Sizes count
+   entries, the cache's byte budget decides how many stay resident */
+class ARC final {
+ private:
+  Chain t1, t2;
+  Ghosts b1, b2;
+  size_t t1_size{0};
+  size_t t2_size{0};
+  size_t p{0};
+  shared_mutex mutex;
+
+  size_t resident() const noexcept {
+    return t1_size + t2_size;
+  }
+
+  void unlink(Hook const& entry) {
+    (entry.owner == &t1 ? t1_size : t2_size)--;
+    Chain::unlink(entry);
+    entry.owner = nullptr;
+  }
+
+  void link_t2(Hook const& entry) {
+    t2.push_front(entry);
+    entry.owner = &t2;
+    ++t2_size;
+  }
+
+ public:
+  ARC() = default;
+  ~ARC() = default;
+  ARC(ARC const&) = delete;
+  ARC(ARC &&) noexcept = delete;
+  ARC &operator=(ARC const&) = delete;
+  ARC &operator=(ARC &&) noexcept = delete;
+
+  void onRecord(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    if (b1.erase(entry.key)) {
+      p = min(resident() + 1, p + max<size_t>(b2.size() / (b1.size() + 1), 1));
+      link_t2(entry);
+    } else if (b2.erase(entry.key)) {
+      p -= min(p, max<size_t>(b1.size() / (b2.size() + 1), 1));
+      link_t2(entry);
+    } else {
+      t1.push_front(entry);
+      entry.owner = &t1;
+      ++t1_size;
+    }
+  }
+  void onDelete(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      unlink(entry);
+    }
+  }
+  void onAccess(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      unlink(entry);
+      link_t2(entry);
+    }
+  }
+  Hook const* onEviction() {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (t1_size == 0 && t2_size == 0) {
+      return nullptr;
+    }
+    bool const from_t1 = t1_size > 0 && (t1_size > p || t2_size == 0);
+    Hook const& victim = from_t1 ? *t1.back() : *t2.back();
+    unlink(victim);
+    (from_t1 ? b1 : b2).push_front(victim.key);
+    // the ghosts remember as many keys as there are resident entries
+    b1.trim(max<size_t>(resident(), 1));
+    b2.trim(max<size_t>(resident(), 1) * 2 - b1.size());
+    return &victim;
+  }
+
+  /* visits "t1" and then "t2", oldest first, with the list as state; "p"
+     and the ghosts are learned again */
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    t1.visit_reverse([&visitor] (Hook const& entry) -> void {
+      visitor(entry, 0);
+    });
+    t2.visit_reverse([&visitor] (Hook const& entry) -> void {
+      visitor(entry, 1);
+    });
+  }
+  void onRestore(Hook const& entry, size_t const state) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    if (state == 0) {
+      t1.push_front(entry);
+      entry.owner = &t1;
+      ++t1_size;
+    } else {
+      link_t2(entry);
+    }
+  }
+
+  // used for interactive demonstration
+  void printAll() {
+    shared_lock<shared_mutex> read_lock(mutex);
+    cout << "p:" << p << endl;
+    t1.visit([] (Hook const& entry) -> void {
+      cout << "t1:" << entry.key << endl;
+    });
+    t2.visit([] (Hook const& entry) -> void {
+      cout << "t2:" << entry.key << endl;
+    });
+    b1.printAll("b1");
+    b2.printAll("b2");
+  }
+  // used for interactive demonstration
+  void delAll() {
+    unique_lock<shared_mutex> write_lock(mutex);
+    t1.clear();
+    t2.clear();
+    b1.clear();
+    b2.clear();
+    t1_size = t2_size = p = 0;
+  }
+};
+
+/* 2Q (Johnson and Shasha): new entries wait in the FIFO "a1in"; the keys it
+   evicts are remembered in "a1out", and only a key recorded again while
+   remembered is admitted to the LRU "am". A scan therefore cycles through
+   "a1in", which keeps a quarter of the resident entries, and leaves "am"
+   alone */
+class TwoQ final {
+ private:
+  Chain a1in, am;
+  Ghosts a1out;
+  size_t a1in_size{0};
+  size_t am_size{0};
+  shared_mutex mutex;
+
+  void unlink(Hook const& entry) {
+    (entry.owner == &a1in ? a1in_size : am_size)--;
+    Chain::unlink(entry);
+    entry.owner = nullptr;
+  }
+
+ public:
+  TwoQ() = default;
+  ~TwoQ() = default;
+  TwoQ(TwoQ const&) = delete;
+  TwoQ(TwoQ &&) noexcept = delete;
+  TwoQ &operator=(TwoQ const&) = delete;
+  TwoQ &operator=(TwoQ &&) noexcept = delete;
+
+  void onRecord(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    if (a1out.erase(entry.key)) {
+      am.push_front(entry);
+      entry.owner = &am;
+      ++am_size;
+    } else {
+      a1in.push_front(entry);
+      entry.owner = &a1in;
+      ++a1in_size;
+    }
+  }
+  void onDelete(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      unlink(entry);
+    }
+  }
+  // a hit in "a1in" is most likely correlated with the first reference
+  void onAccess(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner == &am) {
+      Chain::unlink(entry);
+      am.push_front(entry);
+    }
+  }
+  Hook const* onEviction() {
+    unique_lock<shared_mutex> write_lock(mutex);
+    size_t const resident = a1in_size + am_size;
+    if (resident == 0) {
+      return nullptr;
+    }
+    bool const from_a1in = a1in_size > 0 &&
+                           (a1in_size > resident / 4 || am_size == 0);
+    Hook const& victim = from_a1in ? *a1in.back() : *am.back();
+    unlink(victim);
+    if (from_a1in) {
+      a1out.push_front(victim.key);
+      a1out.trim(max<size_t>(resident / 2, 1));
+    }
+    return &victim;
+  }
+
+  // visits "a1in" and then "am", oldest first, "a1out" is learned again
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    a1in.visit_reverse([&visitor] (Hook const& entry) -> void {
+      visitor(entry, 0);
+    });
+    am.visit_reverse([&visitor] (Hook const& entry) -> void {
+      visitor(entry, 1);
+    });
+  }
+  void onRestore(Hook const& entry, size_t const state) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    Chain & chain = state == 0 ? a1in : am;
+    chain.push_front(entry);
+    entry.owner = &chain;
+    ++(state == 0 ? a1in_size : am_size);
+  }
+
+  // used for interactive demonstration
+  void printAll() {
+    shared_lock<shared_mutex> read_lock(mutex);
+    a1in.visit([] (Hook const& entry) -> void {
+      cout << "a1in:" << entry.key << endl;
+    });
+    am.visit([] (Hook const& entry) -> void {
+      cout << "am:" << entry.key << endl;
+    });
+    a1out.printAll("a1out");
+  }
+  // used for interactive demonstration
+  void delAll() {
+    unique_lock<shared_mutex> write_lock(mutex);
+    a1in.clear();
+    am.clear();
+    a1out.clear();
+    a1in_size = am_size = 0;
+  }
+};
+
+/* W-TinyLFU (Einziger, Friedman and Manes): new entries enter a small LRU
+   "window" of 1% of the resident entries, and the entry pushed out of it
+   becomes the "candidate" at the front of the main region; when room is
+   needed the candidate competes with the main region's victim, and the one
+   a count-min sketch has seen less often is evicted. The main region is a
+   segmented LRU: entries hit in "probation" move to "protection", which
+   keeps up to 80% of the main region. The sketch outlives evictions and
+   halves its counters periodically, so that one-hit wonders are not
+   admitted and old popularity fades out */
+class WTinyLFU final {
+ private:
+  Chain window, probation, protection;
+  size_t window_size{0};
+  size_t probation_size{0};
+  size_t protection_size{0};
+  // the latest entry moved out of the window, until it has been judged
+  Hook const* candidate{nullptr};
+  FrequencySketch sketch;
+  shared_mutex mutex;
+
+  size_t resident() const noexcept {
+    return window_size + probation_size + protection_size;
+  }
+
+  size_t & size_of(void const* const chain) {
+    return chain == &window ? window_size
+         : chain == &probation ? probation_size
+         : protection_size;
+  }
+
+  void link(Chain & chain, Hook const& entry) {
+    chain.push_front(entry);
+    entry.owner = &chain;
+    ++size_of(&chain);
+  }
+
+  void unlink(Hook const& entry) {
+    if (&entry == candidate) {
+      candidate = nullptr;
+    }
+    --size_of(entry.owner);
+    Chain::unlink(entry);
+    entry.owner = nullptr;
+  }
+
+  Hook const* evict(Hook const& victim) {
+    unlink(victim);
+    return &victim;
+  }
+
+ public:
+  WTinyLFU() = default;
+  ~WTinyLFU() = default;
+  WTinyLFU(WTinyLFU const&) = delete;
+  WTinyLFU(WTinyLFU &&) noexcept = delete;
+  WTinyLFU &operator=(WTinyLFU const&) = delete;
+  WTinyLFU &operator=(WTinyLFU &&) noexcept = delete;
+
+  void onRecord(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    sketch.increment(entry.key);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    link(window, entry);
+    if (window_size > max<size_t>(resident() / 100, 1)) {
+      Hook const& oldest = *window.back();
+      unlink(oldest);
+      link(probation, oldest);
+      candidate = &oldest;
+    }
+    // a sketch narrower than the resident entries counts mostly collisions
+    if (resident() > sketch.capacity()) {
+      sketch.grow();
+    }
+  }
+  void onDelete(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      unlink(entry);
+    }
+  }
+  void onAccess(Hook const& entry) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    sketch.increment(entry.key);
+    if (entry.owner == &window || entry.owner == &protection) {
+      Chain & chain = *static_cast<Chain*>(entry.owner);
+      Chain::unlink(entry);
+      chain.push_front(entry);
+    } else if (entry.owner == &probation) {
+      unlink(entry);
+      link(protection, entry);
+      if (protection_size >
+          max<size_t>((probation_size + protection_size) * 4 / 5, 1)) {
+        Hook const& demoted = *protection.back();
+        unlink(demoted);
+        link(probation, demoted);
+      }
+    }
+  }
+  Hook const* onEviction() {
+    unique_lock<shared_mutex> write_lock(mutex);
+    Hook const* victim = probation.back();
+    if (victim == nullptr) {
+      victim = protection.back();
+    }
+    if (victim == nullptr && window.empty()) {
+      return nullptr;
+    }
+    if (victim == nullptr) {
+      return evict(*window.back());
+    }
+    // the candidate is admitted only if it is seen more often than the victim
+    if (candidate != nullptr && candidate != victim &&
+        sketch.frequency(candidate->key) <= sketch.frequency(victim->key)) {
+      return evict(*candidate);
+    }
+    candidate = nullptr;
+    return evict(*victim);
+  }
+
+  /* visits every region oldest first; the state holds the region and the
+     sketch's frequency of the key, which is all of the sketch that is kept */
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    shared_lock<shared_mutex> read_lock(mutex);
+    size_t region{0};
+    for (Chain const* chain : {&window, &probation, &protection}) {
+      chain->visit_reverse(
+        [this, &visitor, region] (Hook const& entry) -> void {
+          visitor(entry, region * 16 + sketch.frequency(entry.key));
+        });
+      ++region;
+    }
+  }
+  void onRestore(Hook const& entry, size_t const state) {
+    unique_lock<shared_mutex> write_lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    Chain* const chains[] = {&window, &probation, &protection};
+    link(*chains[min<size_t>(state / 16, 2)], entry);
+    if (resident() > sketch.capacity()) {
+      sketch.grow();
+    }
+    for (size_t i = 0; i < state % 16; i++) {
+      sketch.increment(entry.key);
+    }
+  }
+
+  // used for interactive demonstration
+  void printAll() {
+    shared_lock<shared_mutex> read_lock(mutex);
+    auto const print = [this] (char const* const name) {
+      return [this, name] (Hook const& entry) -> void {
+        cout << name << ':' << entry.key << ':'
+             << static_cast<unsigned>(sketch.frequency(entry.key)) << endl;
+      };
+    };
+    window.visit(print("window"));
+    probation.visit(print("probation"));
+    protection.visit(print("protection"));
+  }
+  // used for interactive demonstration
+  void delAll() {
+    unique_lock<shared_mutex> write_lock(mutex);
+    window.clear();
+    probation.clear();
+    protection.clear();
+    window_size = probation_size = protection_size = 0;
+    candidate = nullptr;
+    sketch.clear();
+  }
+};
+
+/* CLOCK: entries sit on a ring swept by a hand; an access only sets the
+   entry's reference bit, without any lock, and eviction clears set bits
+   as the hand passes them until it finds an entry that was not accessed
+   since its last pass. Hits are marked while the cache shard is
+   read-locked, eviction happens while it is write-locked, so the bit is
+   never set on an entry that is being unlinked */
+class CLOCK final {
+ private:
+  Chain ring;
+  // the next entry to be examined, nullptr while the ring is empty
+  Hook const* hand{nullptr};
+  std::mutex mutex;
+
+ public:
+  CLOCK() = default;
+  ~CLOCK() = default;
+  CLOCK(CLOCK const&) = delete;
+  CLOCK(CLOCK &&) noexcept = delete;
+  CLOCK &operator=(CLOCK const&) = delete;
+  CLOCK &operator=(CLOCK &&) noexcept = delete;
+
+  // new entries go right behind the hand, the last place it reaches
+  void onRecord(Hook const& entry) {
+    lock_guard<std::mutex> lock(mutex);
+    if (entry.owner != nullptr) {
+      return;
+    }
+    entry.referenced.store(false, memory_order_relaxed);
+    if (hand == nullptr) {
+      ring.push_back(entry);
+      hand = &entry;
+    } else {
+      ring.insert_before(entry, *hand);
+    }
+    entry.owner = &ring;
+  }
+  void onDelete(Hook const& entry) {
+    lock_guard<std::mutex> lock(mutex);
+    if (entry.owner != nullptr) {
+      if (hand == &entry) {
+        hand = ring.after(entry) != &entry ? ring.after(entry) : nullptr;
+      }
+      Chain::unlink(entry);
+      entry.owner = nullptr;
+    }
+  }
+  void onAccess(Hook const& entry) const noexcept {
+    if (!entry.referenced.load(memory_order_relaxed)) {
+      entry.referenced.store(true, memory_order_relaxed);
+    }
+  }
+  Hook const* onEviction() {
+    lock_guard<std::mutex> lock(mutex);
+    if (hand == nullptr) {
+      return nullptr;
+    }
+    while (hand->referenced.load(memory_order_relaxed)) {
+      hand->referenced.store(false, memory_order_relaxed);
+      hand = ring.after(*hand);
+    }
+    Hook const& victim = *hand;
+    hand = ring.after(victim) != &victim ? ring.after(victim) : nullptr;
+    Chain::unlink(victim);
+    victim.owner = nullptr;
+    return &victim;
+  }
+
+  // visits the ring starting at the hand, with the reference bit as state
+  template<typename Visitor>
+  void save(Visitor && visitor) {
+    lock_guard<std::mutex> lock(mutex);
+    if (hand == nullptr) {
+      return;
+    }
+    Hook const* entry = hand;
+    do {
+      visitor(*entry, entry->referenced.load(memory_order_relaxed) ? 1 : 0);
+      entry = ring.after(*entry);
+    } while (entry != hand);
+  }
+  // the first entry restored gets the hand, the others follow in order
+  void onRestore(Hook const& entry, size_t const state) {
+    onRecord(entry);
+    entry.referenced.store(state != 0, memory_order_relaxed);
+  }
+
+  // used for interactive demonstration
+  void printAll() {
+    lock_guard<std::mutex> lock(mutex);
+    ring.visit([this] (Hook const& entry) -> void {
+      cout << (&entry == hand ? "> " : "  ") << entry.key << ':'
+           << entry.referenced.load(memory_order_relaxed) << endl;
+    });
+  }
+  // used for interactive demonstration
+  void delAll() {
+    lock_guard<std::mutex> lock(mutex);
+    ring.clear();
+    hand = nullptr;
+  }
+};
@@ -7,6 +7,7 @@ int main(int argc, char* argv[]) {
                      "d - delete from KeyValueStore\n"
                      "P - print all KeyValueStore\n"
                      "D - delete all KeyValueStore\n"
+                     "s - print KeyValueStore statistics\n"
                      "q - quit"};
   KeyValueStore<LFU> key_value_store(20);
 
@@ -27,7 +28,10 @@ int main(int argc, char* argv[]) {
           cin >> input;
           cout << ">> value: ";
           cin >> input2;
-          key_value_store.record(input, input2);
+          Evicted const evicted = key_value_store.record(input, input2);
+          if (evicted.entries > 0)
+            cout << "evicted " << evicted.entries << " record(s), "
+                 << evicted.bytes << " bytes to disk" << endl;
         } else if (input == "a") {
           cout << ">> key: ";
           cin >> input;
@@ -47,6 +51,8 @@ int main(int argc, char* argv[]) {
           key_value_store.printAll();
         } else if (input == "D") {
           key_value_store.delAll();
+        } else if (input == "s") {
+          key_value_store.printStats();
         } else if (input == "q") {
           break;
         } else {
@@ -2,6 +2,8 @@
 #define BOOST_TEST_MODULE KeyValueStore
 
 
+#include <atomic>
+#include <random>
 #include <thread>
 #include <vector>
 #include <boost/test/unit_test.hpp>
@@ -23,6 +25,48 @@ string random_string(size_t const len) {
   return ret;
 }
 
+/* records a hot set of 5 keys into a cache of 20 entries, gets it evicted
+   and read back from the disk, then scans 100 keys read only once;
+   returns how many hot keys are still cached afterwards */
+template<typename Strategy>
+size_t hot_keys_after_scan() {
+  KeyValueStore<Strategy> key_value_store(120);
+  for (size_t i = 0; i < 5; i++)
+    key_value_store.record("h" + to_string(10+i), "hot");
+  for (size_t i = 0; i < 20; i++)
+    key_value_store.record("f" + to_string(10+i), "aaa");
+  for (size_t round = 0; round < 3; round++)
+    for (size_t i = 0; i < 5; i++)
+      key_value_store.retrieve("h" + to_string(10+i));
+  for (size_t i = 0; i < 100; i++)
+    key_value_store.record("s" + to_string(100+i), "aa");
+  size_t cached{0};
+  for (size_t i = 0; i < 5; i++)
+    cached += key_value_store.cache.get("h" + to_string(10+i)).has_value();
+  return cached;
+}
+
+/* accesses 10 keys 10 times each, then moves on to 20 other keys accessed
+   in turns; returns how many of the new keys end up cached */
+template<typename Strategy>
+size_t new_keys_after_shift() {
+  KeyValueStore<Strategy> key_value_store(120);
+  for (size_t i = 0; i < 10; i++) {
+    key_value_store.record("o" + to_string(10+i), "old");
+    for (size_t j = 0; j < 10; j++)
+      key_value_store.retrieve("o" + to_string(10+i));
+  }
+  for (size_t i = 0; i < 20; i++)
+    key_value_store.record("n" + to_string(10+i), "new");
+  for (size_t round = 0; round < 50; round++)
+    for (size_t i = 0; i < 20; i++)
+      key_value_store.retrieve("n" + to_string(10+i));
+  size_t cached{0};
+  for (size_t i = 0; i < 20; i++)
+    cached += key_value_store.cache.get("n" + to_string(10+i)).has_value();
+  return cached;
+}
+
 BOOST_AUTO_TEST_SUITE(Tests)
   BOOST_AUTO_TEST_CASE(Test_Disk_PutGetDel) {
     Disk disk;
@@ -42,6 +86,328 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(disk.get("111").has_value(), false);
   }
 
+  BOOST_AUTO_TEST_CASE(Test_Disk_OverwriteAndDel) {
+    Disk disk;
+    disk.put("111", "aaa");
+    disk.put("222", "bbb");
+    disk.put("333", "ccc");
+
+    // the latest record of a key wins
+    disk.put("111", "aaaa");
+    BOOST_CHECK_EQUAL(disk.get("111").value(), "aaaa");
+
+    // deleting a key keeps records of the other keys readable
+    BOOST_CHECK_EQUAL(disk.del("222"), true);
+    BOOST_CHECK_EQUAL(disk.get("222").has_value(), false);
+    BOOST_CHECK_EQUAL(disk.get("111").value(), "aaaa");
+    BOOST_CHECK_EQUAL(disk.get("333").value(), "ccc");
+
+    // records appended after a delete are readable as well
+    disk.put("444", "ddd");
+    BOOST_CHECK_EQUAL(disk.get("444").value(), "ddd");
+    BOOST_CHECK_EQUAL(disk.del("111"), true);
+    BOOST_CHECK_EQUAL(disk.get("111").has_value(), false);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_Compaction) {
+    // seal a segment every 64 bytes, compact at 50% dead bytes
+    Disk disk(0.5, 64);
+    for (size_t i = 0; i < 40; i++)
+      disk.put(to_string(100+i), string(10, alphanum[i]));
+    size_t const size_written = disk.size();
+
+    // delete three quarters of the keys and overwrite the rest
+    for (size_t i = 0; i < 40; i++) {
+      if (i % 4 != 0)
+        BOOST_CHECK_EQUAL(disk.del(to_string(100+i)), true);
+      else
+        disk.put(to_string(100+i), string(5, alphanum[i]));
+    }
+
+    // dead records and obsolete tombstones are reclaimed
+    disk.compact();
+    BOOST_CHECK_LT(disk.size(), size_written);
+
+    // live data survives compaction
+    for (size_t i = 0; i < 40; i++) {
+      if (i % 4 != 0)
+        BOOST_CHECK_EQUAL(disk.get(to_string(100+i)).has_value(), false);
+      else
+        BOOST_CHECK_EQUAL(disk.get(to_string(100+i)).value(),
+                          string(5, alphanum[i]));
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_CompactionLeftovers) {
+    // files a crash left behind while compacting and migrating
+    ofstream("Storage_records.7.compact") << "partial";
+    ofstream("Storage_records.7.migrate") << "partial";
+    Disk disk;
+    BOOST_CHECK_EQUAL(filesystem::exists("Storage_records.7.compact"), false);
+    BOOST_CHECK_EQUAL(filesystem::exists("Storage_records.7.migrate"), false);
+    BOOST_CHECK_EQUAL(disk.get("7").has_value(), false);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_CompactionKeptTombstones) {
+    // every record fills a segment of its own, but the tombstones
+    Disk disk(0.5, 64);
+    disk.put("zzz", string(100, 'z'));
+    for (size_t i = 0; i < 4; i++)
+      disk.put(to_string(100+i), string(100, alphanum[i]));
+    for (size_t i = 0; i < 4; i++)
+      disk.del(to_string(100+i));
+    // the tombstones are kept, an older segment still holds "zzz"
+    disk.compact();
+    disk.del("zzz");
+    // once that segment is gone, the tombstones are compacted away too
+    disk.compact();
+    BOOST_CHECK_LT(disk.size(), 64);
+    BOOST_CHECK_EQUAL(disk.get("zzz").has_value(), false);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_MappedReads) {
+    Disk disk(0.5, 64, Disk::Reads::Mapped);
+    disk.put("111", "aaa");
+    optional<Disk::View> const view = disk.view("111");
+    BOOST_CHECK_EQUAL(view.value().value, "aaa");
+
+    // the segment grows past the current mapping and is remapped
+    for (size_t i = 0; i < 20; i++)
+      disk.put(to_string(200+i), string(i, 'x'));
+    for (size_t i = 0; i < 20; i++)
+      BOOST_CHECK_EQUAL(disk.get(to_string(200+i)).value(), string(i, 'x'));
+
+    // the view stays readable after its segment is rewritten
+    BOOST_CHECK_EQUAL(disk.del("111"), true);
+    disk.compact();
+    BOOST_CHECK_EQUAL(disk.get("111").has_value(), false);
+    BOOST_CHECK_EQUAL(view.value().value, "aaa");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_PutBatch) {
+    Disk disk(0.5, 32);
+    // the batch spans several segments, the later record of a key wins
+    disk.put({{"111", "aaa"}, {"222", "bbb"}, {"111", "aaaa"},
+              {"333", string(40, 'c')}, {"444", "ddd"}});
+    BOOST_CHECK_EQUAL(disk.get("111").value(), "aaaa");
+    BOOST_CHECK_EQUAL(disk.get("222").value(), "bbb");
+    BOOST_CHECK_EQUAL(disk.get("333").value(), string(40, 'c'));
+    BOOST_CHECK_EQUAL(disk.get("444").value(), "ddd");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_Filter) {
+    {
+      Disk disk;
+      // the filter grows past its initial capacity along with the index
+      for (size_t i = 0; i < 5000; i++)
+        disk.put(to_string(i), "aaa");
+      for (size_t i = 0; i < 5000; i++)
+        BOOST_CHECK_EQUAL(disk.may_contain(to_string(i)), true);
+      Disk::FilterStats stats = disk.filter_stats();
+      BOOST_CHECK_EQUAL(stats.keys, 5000);
+      BOOST_CHECK_GE(stats.bytes, 5000 * 5);
+      BOOST_CHECK_LT(stats.false_positive_rate, 0.02);
+
+      // keys never written are mostly answered without the index
+      for (size_t i = 5000; i < 15000; i++)
+        BOOST_CHECK_EQUAL(disk.get(to_string(i)).has_value(), false);
+      stats = disk.filter_stats();
+      BOOST_CHECK_EQUAL(stats.negatives + stats.false_positives, 10000);
+      BOOST_CHECK_LT(stats.false_positives, 500);
+
+      // deleted keys leave the filter
+      for (size_t i = 0; i < 5000; i += 2)
+        disk.del(to_string(i));
+      BOOST_CHECK_EQUAL(disk.filter_stats().keys, 2500);
+      size_t passed{0};
+      for (size_t i = 0; i < 5000; i += 2)
+        passed += disk.may_contain(to_string(i));
+      BOOST_CHECK_LT(passed, 250);
+      BOOST_CHECK_EQUAL(disk.get("1").value(), "aaa");
+    }
+
+    // a miss of the whole store is answered by the filter as well
+    KeyValueStore<LRU> key_value_store(20);
+    key_value_store.record("111", "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("999").has_value(), false);
+    BOOST_CHECK_EQUAL(key_value_store.disk.filter_stats().negatives, 1);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_Reopen) {
+    auto const check = [] (Disk & disk) -> void {
+      for (size_t i = 0; i < 40; i++) {
+        if (i % 3 == 0)
+          BOOST_CHECK_EQUAL(disk.get(to_string(100+i)).has_value(), false);
+        else if (i % 3 == 1)
+          BOOST_CHECK_EQUAL(disk.get(to_string(100+i)).value(), "new");
+        else
+          BOOST_CHECK_EQUAL(disk.get(to_string(100+i)).value(),
+                            string(10, alphanum[i]));
+      }
+    };
+    size_t size_written;
+    {
+      // many small segments, each replayed by a worker of its own
+      Disk disk(0.9, 64, Disk::Reads::Mapped, Disk::Lifetime::Persistent);
+      for (size_t i = 0; i < 40; i++)
+        disk.put(to_string(100+i), string(10, alphanum[i]));
+      for (size_t i = 0; i < 40; i += 3)
+        disk.del(to_string(100+i));
+      for (size_t i = 1; i < 40; i += 3)
+        disk.put(to_string(100+i), "new");
+      // done with what the compactor would otherwise do at any time
+      disk.compact();
+      size_written = disk.size();
+    }
+    // without the checkpoint written on closing everything is replayed
+    remove("Storage_index");
+    {
+      Disk disk(0.9, 64, Disk::Reads::Mapped, Disk::Lifetime::Persistent);
+      check(disk);
+      BOOST_CHECK_EQUAL(disk.size(), size_written);
+      // records appended after a checkpoint are replayed on top of it
+      disk.checkpoint();
+      filesystem::copy_file("Storage_index", "Storage_index.saved");
+      disk.put("100", "tail");
+      disk.del("101");
+      disk.compact();
+      size_written = disk.size();
+    }
+    rename("Storage_index.saved", "Storage_index");
+    {
+      Disk disk(0.9, 64, Disk::Reads::Mapped, Disk::Lifetime::Persistent);
+      BOOST_CHECK_EQUAL(disk.get("100").value(), "tail");
+      BOOST_CHECK_EQUAL(disk.get("101").has_value(), false);
+      BOOST_CHECK_EQUAL(disk.size(), size_written);
+    }
+    {
+      Disk disk(0.5, 64, Disk::Reads::Mapped, Disk::Lifetime::Persistent);
+      disk.put("100", "new");
+      disk.put("101", "new");
+      // compaction moves records, so it drops the checkpoint
+      disk.compact();
+      BOOST_CHECK_EQUAL(filesystem::exists("Storage_index"), false);
+    }
+    // a temporary disk replays the files as well, and removes them
+    Disk disk;
+    disk.del("100");
+    check(disk);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_Records) {
+    // segments in the former text format are migrated on opening
+    {
+      ofstream keys("Storage_keys.0"), values("Storage_values.0");
+      keys << "+111\n+222\n-111\n+333\n";
+      values << "aaa\nbbb\n\nccc\n";
+    }
+    {
+      Disk disk(0.9, 1024, Disk::Reads::Streamed, Disk::Lifetime::Persistent);
+      BOOST_CHECK_EQUAL(disk.get("111").has_value(), false);
+      BOOST_CHECK_EQUAL(disk.get("222").value(), "bbb");
+      BOOST_CHECK_EQUAL(disk.get("333").value(), "ccc");
+      BOOST_CHECK_EQUAL(filesystem::exists("Storage_keys.0"), false);
+      // values are length-prefixed, any byte may be part of them
+      disk.put("444", string("line\nbreak\0", 11));
+      disk.put("555", "last");
+    }
+    // a record torn by a crash is dropped, and so is everything after it
+    remove("Storage_index");
+    filesystem::resize_file("Storage_records.0",
+                            filesystem::file_size("Storage_records.0") - 1);
+    {
+      Disk disk(0.9, 1024, Disk::Reads::Mapped, Disk::Lifetime::Persistent);
+      BOOST_CHECK_EQUAL(disk.get("444").value(), string("line\nbreak\0", 11));
+      BOOST_CHECK_EQUAL(disk.get("555").has_value(), false);
+      // appends continue after the last intact record
+      disk.put("555", "again");
+    }
+    Disk disk;
+    BOOST_CHECK_EQUAL(disk.get("222").value(), "bbb");
+    BOOST_CHECK_EQUAL(disk.get("555").value(), "again");
+    // lengths beyond 32 bits do not fit into a header
+    BOOST_CHECK_EQUAL(RecordHeader::fits(3, RecordHeader::max_length), true);
+    BOOST_CHECK_EQUAL(RecordHeader::fits(3, RecordHeader::max_length + 1),
+                      false);
+    BOOST_CHECK_EQUAL(RecordHeader::fits(RecordHeader::max_length + 1, 3),
+                      false);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_CorruptSealedSegment) {
+    {
+      Disk disk(0.9, 64, Disk::Reads::Mapped, Disk::Lifetime::Persistent);
+      for (size_t i = 0; i < 20; i++)
+        disk.put(to_string(100+i), "aaa");
+    }
+    remove("Storage_index");
+    uintmax_t const size = filesystem::file_size("Storage_records.0");
+    BOOST_CHECK(filesystem::exists("Storage_records.1"));
+    // a byte flipped in the middle of a sealed segment
+    auto const flip = [] () -> void {
+      fstream stream("Storage_records.0",
+                     ios::in | ios::out | ios::binary);
+      stream.seekg(20);
+      char const byte = static_cast<char>(stream.get());
+      stream.seekp(20);
+      stream.put(static_cast<char>(byte ^ 0x01));
+    };
+    flip();
+    BOOST_CHECK_THROW(
+      Disk(0.9, 64, Disk::Reads::Mapped, Disk::Lifetime::Persistent),
+      ios::failure);
+    // the records after the damage are not cut off
+    BOOST_CHECK_EQUAL(filesystem::file_size("Storage_records.0"), size);
+    flip();
+    Disk disk(0.9, 64);
+    for (size_t i = 0; i < 20; i++)
+      BOOST_CHECK_EQUAL(disk.get(to_string(100+i)).value(), "aaa");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Disk_Compression) {
+    auto const value = [] (size_t const i) -> string {
+      return "{\"id\": " + to_string(i) + ", \"name\": \"" +
+             string(100, alphanum[i % 62]) + "\", \"active\": true}";
+    };
+    // headers of 13 bytes, keys and values
+    size_t size_raw{0};
+    {
+      Disk disk(0.5, 16 << 10, Disk::Reads::Mapped,
+                Disk::Lifetime::Persistent, 0, Disk::Compression::Blocks);
+      for (size_t i = 0; i < 1000; i++) {
+        disk.put(to_string(i), value(i));
+        size_raw += 13 + to_string(i).length() + value(i).length();
+      }
+      for (size_t i = 0; i < 1000; i += 10)
+        disk.del(to_string(i));
+      disk.compact();
+      // every sealed segment is rewritten as compressed blocks
+      BOOST_CHECK_LT(disk.size() * 3, size_raw);
+      for (size_t i = 0; i < 1000; i++) {
+        if (i % 10 == 0)
+          BOOST_CHECK_EQUAL(disk.get(to_string(i)).has_value(), false);
+        else
+          BOOST_CHECK_EQUAL(disk.get(to_string(i)).value(), value(i));
+      }
+      // values of one block are decompressed once
+      BOOST_CHECK_GT(disk.block_stats().hits, disk.block_stats().misses);
+      disk.put("1", "new");
+    }
+    // blocks are replayed, with the checkpoint and without it
+    for (size_t pass = 0; pass < 2; pass++) {
+      Disk disk(0.5, 16 << 10, Disk::Reads::Streamed,
+                Disk::Lifetime::Persistent);
+      BOOST_CHECK_EQUAL(disk.get("1").value(), "new");
+      BOOST_CHECK_EQUAL(disk.get("10").has_value(), false);
+      BOOST_CHECK_EQUAL(disk.get("999").value(), value(999));
+      remove("Storage_index");
+    }
+    // without compression, compaction unpacks the blocks again
+    Disk disk(0.0, 16 << 10);
+    disk.compact();
+    BOOST_CHECK_GE(disk.size(), size_raw / 2);
+    BOOST_CHECK_EQUAL(disk.get("2").value(), value(2));
+  }
+
   BOOST_AUTO_TEST_CASE(Test_Cache_PutGetDel) {
     Cache cache;
     // try to get non-existent element
@@ -89,6 +455,143 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(cache.size(), 0);
   }
 
+  BOOST_AUTO_TEST_CASE(Test_Cache_SlabStorage) {
+    Cache cache(2, Cache::Storage::Slab);
+    size_t payload{0};
+    // short values live inside their string, long ones next to the slabs
+    for (size_t i = 0; i < 500; i++) {
+      string const value(1 + i % 60, 'v');
+      cache.put(to_string(i), value);
+      payload += to_string(i).length() + value.length();
+    }
+    // the budget counts what the allocator handed out, not just the payload
+    BOOST_CHECK_EQUAL(cache.size(), cache.allocated());
+    BOOST_CHECK_GT(cache.size(), payload);
+
+    // overwriting and deleting give the chunks back
+    for (size_t i = 0; i < 500; i += 2)
+      cache.put(to_string(i), "aaa");
+    for (size_t i = 1; i < 500; i += 4)
+      cache.del(to_string(i));
+    BOOST_CHECK_EQUAL(cache.size(), cache.allocated());
+    BOOST_CHECK_EQUAL(cache.get("0").value(), "aaa");
+    BOOST_CHECK_EQUAL(cache.get("3").value(), string(4, 'v'));
+    BOOST_CHECK_EQUAL(cache.get("1").has_value(), false);
+
+    // only the bucket arrays remain
+    cache.delAll();
+    BOOST_CHECK_EQUAL(cache.size(), cache.allocated());
+
+    KeyValueStore<LRU> key_value_store(8192, 1, 0, Cache::Storage::Slab);
+    for (size_t i = 0; i < 300; i++)
+      key_value_store.record(to_string(i), string(1 + i % 40, 'v'));
+    BOOST_CHECK_LE(key_value_store.cache.size(), 8192);
+    BOOST_CHECK_EQUAL(key_value_store.cache.size(),
+                      key_value_store.cache.allocated());
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("0").value(), "v");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_LargerThanShard) {
+    // 4 shards of 10 bytes each
+    KeyValueStore<LRU> key_value_store(40, 4);
+    string const large(15, 'x');
+    key_value_store.record("111", large);
+    key_value_store.record("222", "bbb");
+    key_value_store.record("222", large);
+    // neither is cached, both are kept on the disk
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("111").has_value(), false);
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("222").has_value(), false);
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("111").value(), large);
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("222").value(), large);
+    BOOST_CHECK_EQUAL(*key_value_store.retrieve_many({"111", "222"})[1],
+                      large);
+    // promotion fails, so the disk copy stays
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), large);
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("222").value(), large);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_SlabBucketArray) {
+    KeyValueStore<LRU> key_value_store(8192, 1, 0, Cache::Storage::Slab);
+    for (size_t i = 0; i < 300; i++)
+      key_value_store.record(to_string(i), "v");
+    // fits the budget, but not next to the bucket array the shard keeps
+    key_value_store.record("big", string(7500, 'x'));
+    BOOST_CHECK_LE(key_value_store.cache.size(), 8192);
+    BOOST_CHECK_EQUAL(key_value_store.cache.size(),
+                      key_value_store.cache.allocated());
+    // a value the shard cannot hold at all is kept on the disk
+    key_value_store.record("huge", string(8000, 'y'));
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("huge").value(),
+                      string(8000, 'y'));
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Cache_LockFreeReads) {
+    Cache cache(2, Cache::Storage::Heap, Cache::Lookups::LockFree);
+    size_t const number_of_keys = 64;
+    atomic<bool> done{false};
+    atomic<size_t> torn{0};
+    vector<thread> threads;
+    /* writers overwrite, delete and re-add values that start with their key,
+       so that a reader seeing a freed or foreign value notices */
+    for (size_t id = 0; id < 2; id++) {
+      threads.emplace_back([&cache, id] () -> void {
+        for (size_t i = 0; i < 20000; i++) {
+          string const key = to_string((i * 7 + id) % number_of_keys);
+          if (i % 5 == 0) {
+            cache.del(key);
+          } else {
+            cache.put(key, key + ':' + string(i % 100, 'v'));
+          }
+        }
+      });
+    }
+    for (size_t id = 0; id < 3; id++) {
+      threads.emplace_back([&cache, &done, &torn, id] () -> void {
+        size_t i = id;
+        while (!done.load()) {
+          string const key = to_string(i++ % number_of_keys);
+          auto const value = cache.get(key);
+          if (value && value->compare(0, key.length() + 1, key + ':') != 0)
+            ++torn;
+          cache.get_with(key, [&key, &torn] (string_view const found) -> void {
+            if (found.substr(0, key.length() + 1) != key + ':')
+              ++torn;
+          });
+          auto const shared = cache.share(key);
+          if (shared && shared->compare(0, key.length() + 1, key + ':') != 0)
+            ++torn;
+        }
+      });
+    }
+    threads[0].join();
+    threads[1].join();
+    done.store(true);
+    for (size_t i = 2; i < threads.size(); i++)
+      threads[i].join();
+    BOOST_CHECK_EQUAL(torn.load(), 0);
+
+    // the index agrees with the table once writers are done
+    for (size_t i = 0; i < number_of_keys; i++) {
+      string const key = to_string(i);
+      BOOST_CHECK(cache.get(key) == cache.read(cache.shard(key)).get(key));
+    }
+    cache.delAll();
+    BOOST_CHECK_EQUAL(cache.get("1").has_value(), false);
+    // with no reader left every replaced node can be freed
+    BOOST_CHECK_EQUAL(Epoch::domain().reclaim(), 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_Strategy_EmptyEviction) {
+    // a strategy without entries has no victim to hand out
+    BOOST_CHECK(FIFO().onEviction() == nullptr);
+    BOOST_CHECK(LRU().onEviction() == nullptr);
+    BOOST_CHECK(LFU().onEviction() == nullptr);
+    BOOST_CHECK(ARC().onEviction() == nullptr);
+    BOOST_CHECK(TwoQ().onEviction() == nullptr);
+    BOOST_CHECK(WTinyLFU().onEviction() == nullptr);
+    BOOST_CHECK(CLOCK().onEviction() == nullptr);
+  }
+
   BOOST_AUTO_TEST_CASE(Test_KeyValueStore_FIFO) {
     KeyValueStore<FIFO> key_value_store(20);
 
@@ -115,6 +618,23 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(key_value_store.disk.get("222").value(), "bbb");
   }
 
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_EvictionBatch) {
+    KeyValueStore<FIFO> key_value_store(20);
+
+    // prefill cache (6+6+6+2 characters)
+    BOOST_CHECK_EQUAL(key_value_store.record("111", "aaa").entries, 0);
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+    key_value_store.record("4", "d");
+
+    // "111":"aaa" and "222":"bbb" leave the cache in a single batch
+    Evicted const evicted = key_value_store.record("666", "evil");
+    BOOST_CHECK_EQUAL(evicted.entries, 2);
+    BOOST_CHECK_EQUAL(evicted.bytes, 12);
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("222").value(), "bbb");
+  }
+
   BOOST_AUTO_TEST_CASE(Test_KeyValueStore_LRU) {
     KeyValueStore<LRU> key_value_store(20);
 
@@ -145,6 +665,28 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(key_value_store.disk.get("333").value(), "ccc");
   }
 
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_LRU_DeleteAndReaccess) {
+    KeyValueStore<LRU> key_value_store(20);
+
+    // prefill cache (6+6+6 characters)
+    key_value_store.record("111", "aaa");
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+
+    // remove the middle element and access the oldest one
+    BOOST_CHECK_EQUAL(key_value_store.del("222"), true);
+    key_value_store.retrieve("111");
+
+    // 12+6 characters fit, 18+6 characters do not: "333":"ccc" is the least
+    // recently used element and the only one evicted
+    key_value_store.record("444", "ddd");
+    key_value_store.record("555", "eee");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("333").has_value(), false);
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("111").value(), "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("333").value(), "ccc");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("222").has_value(), false);
+  }
+
   BOOST_AUTO_TEST_CASE(Test_KeyValueStore_LFU) {
     KeyValueStore<LFU> key_value_store(20);
 
@@ -180,6 +722,303 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(key_value_store.disk.get("4").value(), "d");
   }
 
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_LFU_DeleteAndRerecord) {
+    KeyValueStore<LFU> key_value_store(20);
+
+    // prefill cache (6+6+6 characters), "111" is the most frequently used
+    key_value_store.record("111", "aaa");
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+    key_value_store.retrieve("111");
+    key_value_store.retrieve("111");
+    key_value_store.retrieve("222");
+    key_value_store.retrieve("333");
+
+    // a deleted and recorded again key starts over with no accesses
+    BOOST_CHECK_EQUAL(key_value_store.del("111"), true);
+    key_value_store.record("111", "aaa");
+    // an overwritten key keeps its frequency and gains an access
+    key_value_store.record("222", "bb");
+
+    Evicted const evicted = key_value_store.record("444", "ddd");
+    BOOST_CHECK_EQUAL(evicted.entries, 1);
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("222").value(), "bb");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("333").value(), "ccc");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_ScanResistance) {
+    // a one-pass scan flushes the hot set out of LRU and FIFO
+    BOOST_CHECK_EQUAL(hot_keys_after_scan<LRU>(), 0);
+    BOOST_CHECK_EQUAL(hot_keys_after_scan<FIFO>(), 0);
+    // ARC and 2Q keep keys seen again apart from the scanned ones
+    BOOST_CHECK_EQUAL(hot_keys_after_scan<ARC>(), 5);
+    BOOST_CHECK_EQUAL(hot_keys_after_scan<TwoQ>(), 5);
+    BOOST_CHECK_EQUAL(hot_keys_after_scan<WTinyLFU>(), 5);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_ARC) {
+    KeyValueStore<ARC> key_value_store(20);
+
+    // prefill cache (6+6+6 characters)
+    key_value_store.record("111", "aaa");
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+    // "111" has been seen twice, the others once
+    key_value_store.retrieve("111");
+
+    // entries seen once are evicted first, the oldest of them first
+    key_value_store.record("444", "ddd");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("222").value(), "bbb");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("111").value(), "aaa");
+
+    // "222" is remembered as a ghost and comes back as a frequent entry
+    key_value_store.retrieve("222");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("333").value(), "ccc");
+
+    /* the ghost hit raised the share of entries seen once, so the least
+       recently used frequent entry "111" goes next, not "444" */
+    key_value_store.record("555", "eee");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("222").value(), "bbb");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("444").value(), "ddd");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_2Q) {
+    KeyValueStore<TwoQ> key_value_store(20);
+
+    // prefill cache (6+6+6 characters)
+    key_value_store.record("111", "aaa");
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+    // hits in the FIFO do not change its order
+    key_value_store.retrieve("111");
+    key_value_store.record("444", "ddd");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), "aaa");
+
+    // a remembered key is admitted to the LRU and outlives newer entries
+    key_value_store.retrieve("111");
+    key_value_store.record("555", "eee");
+    key_value_store.record("666", "fff");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("111").value(), "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("444").value(), "ddd");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_FrequencySketch) {
+    FrequencySketch sketch(64);
+    for (size_t i = 0; i < 20; i++)
+      sketch.increment("111");
+    sketch.increment("222");
+    // counters saturate at 15
+    BOOST_CHECK_EQUAL(sketch.frequency("111"), 15);
+    BOOST_CHECK_EQUAL(sketch.frequency("222"), 1);
+    BOOST_CHECK_EQUAL(sketch.frequency("333"), 0);
+    BOOST_CHECK_EQUAL(sketch.memory(), 128);
+
+    // 640 increments halve every counter
+    for (size_t i = 0; i < 619; i++)
+      sketch.increment(to_string(1000+i % 7));
+    BOOST_CHECK_EQUAL(sketch.frequency("111"), 7);
+    BOOST_CHECK_EQUAL(sketch.frequency("222"), 0);
+
+    // growing keeps every count, restored ones included
+    vector<uint8_t> before;
+    for (size_t i = 0; i < 200; i++)
+      before.push_back(sketch.frequency(to_string(1000+i)));
+    sketch.grow();
+    BOOST_CHECK_EQUAL(sketch.capacity(), 128);
+    BOOST_CHECK_EQUAL(sketch.frequency("111"), 7);
+    for (size_t i = 0; i < 200; i++)
+      BOOST_CHECK_EQUAL(sketch.frequency(to_string(1000+i)), before[i]);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_WTinyLFU) {
+    /* LFU forgets the count of every key it evicts, so keys that were hot
+       long ago keep half of the cache; W-TinyLFU remembers the counts of
+       evicted keys and gives the cache to the keys hot now */
+    size_t const lfu = new_keys_after_shift<LFU>();
+    size_t const tiny_lfu = new_keys_after_shift<WTinyLFU>();
+    BOOST_CHECK_LE(lfu, 10);
+    BOOST_CHECK_GE(tiny_lfu, 15);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_CLOCK) {
+    KeyValueStore<CLOCK> key_value_store(20);
+
+    // prefill cache (6+6+6 characters)
+    key_value_store.record("111", "aaa");
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+
+    // accessed entries get a second chance, the hand stops at "222"
+    key_value_store.retrieve("111");
+    key_value_store.record("444", "ddd");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("222").value(), "bbb");
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("111").value(), "aaa");
+
+    // the hand moves on from where it stopped, "111" lost its mark
+    key_value_store.record("555", "eee");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("333").value(), "ccc");
+    key_value_store.record("666", "fff");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), "aaa");
+
+    // hits from many threads only set bits, while a writer evicts
+    vector<thread> threads;
+    for (size_t id = 0; id < 4; id++) {
+      threads.emplace_back([&key_value_store, id] () -> void {
+        for (size_t i = 0; i < 2000; i++) {
+          if (id == 0)
+            key_value_store.record(to_string(i % 50), "x");
+          else
+            key_value_store.retrieve(to_string((i * id) % 50));
+        }
+      });
+    }
+    for (auto & thread : threads)
+      thread.join();
+    BOOST_CHECK_LE(key_value_store.cache.size(), 20);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_Sharded) {
+    // 4 shards with 30 bytes of budget each
+    KeyValueStore<LRU> key_value_store(120, 4);
+    for (size_t i = 0; i < 100; i++)
+      key_value_store.record(to_string(100+i), "aaa");
+
+    // every shard stays within its own share of the budget
+    BOOST_CHECK_EQUAL(key_value_store.cache.shard_count(), 4);
+    for (size_t shard = 0; shard < 4; shard++)
+      BOOST_CHECK_LE(key_value_store.cache.size(shard), 30);
+    BOOST_CHECK_LE(key_value_store.cache.size(), 120);
+
+    // evicted records are still reachable through the disk
+    for (size_t i = 0; i < 100; i++)
+      BOOST_CHECK_EQUAL(key_value_store.retrieve(to_string(100+i)).value(),
+                        "aaa");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_Batch) {
+    // 2 shards with 30 bytes of budget each
+    KeyValueStore<LRU> key_value_store(60, 2);
+    vector<pair<string_view, string>> records;
+    vector<string> keys;
+    for (size_t i = 0; i < 20; i++)
+      keys.push_back(to_string(100+i));
+    for (size_t i = 0; i < 20; i++)
+      records.emplace_back(keys[i], string(3, alphanum[i]));
+
+    // the evictions of the whole batch are reported together
+    Evicted const evicted = key_value_store.record_many(move(records));
+    BOOST_CHECK_EQUAL(evicted.entries, 20 - key_value_store.cache.size() / 6);
+    BOOST_CHECK_EQUAL(evicted.bytes, 120 - key_value_store.cache.size());
+
+    // values come back in input order, from the cache or the disk
+    vector<string_view> const wanted{keys[19], "999", keys[0], keys[7],
+                                     keys[0]};
+    auto const values = key_value_store.retrieve_many(wanted);
+    BOOST_CHECK_EQUAL(values.size(), 5);
+    BOOST_CHECK_EQUAL(*values[0], string(3, alphanum[19]));
+    BOOST_CHECK_EQUAL(values[1], nullptr);
+    BOOST_CHECK_EQUAL(*values[2], string(3, alphanum[0]));
+    BOOST_CHECK_EQUAL(*values[3], string(3, alphanum[7]));
+    BOOST_CHECK_EQUAL(*values[4], string(3, alphanum[0]));
+    BOOST_CHECK_LE(key_value_store.cache.size(), 60);
+
+    // promoted keys left the disk
+    BOOST_CHECK_EQUAL(key_value_store.disk.get(keys[0]).has_value(), false);
+    BOOST_CHECK_EQUAL(key_value_store.disk.get(keys[7]).has_value(), false);
+
+    vector<bool> const deleted =
+      key_value_store.del_many({keys[0], "999", keys[7]});
+    BOOST_CHECK_EQUAL(deleted[0], true);
+    BOOST_CHECK_EQUAL(deleted[1], false);
+    BOOST_CHECK_EQUAL(deleted[2], true);
+    BOOST_CHECK_EQUAL(key_value_store.retrieve(keys[0]).has_value(), false);
+    for (size_t i = 1; i < 20; i++)
+      if (i != 7)
+        BOOST_CHECK_EQUAL(key_value_store.retrieve(keys[i]).value(),
+                          string(3, alphanum[i]));
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_WriteBehind) {
+    // write-behind with a high-water mark of 16 bytes
+    KeyValueStore<FIFO> key_value_store(20, 1, 16);
+    for (size_t i = 0; i < 50; i++)
+      key_value_store.record(to_string(100+i), "aaa");
+
+    // an evicted record is reachable, wherever the flusher is
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("100").value(), "aaa");
+
+    // after draining, evicted records are on the disk, promoted ones are not
+    key_value_store.staging->drain();
+    BOOST_CHECK_EQUAL(key_value_store.staging->size(), 0);
+    BOOST_CHECK_EQUAL(key_value_store.cache.get("100").value(), "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("100").has_value(), false);
+    for (size_t i = 1; i < 47; i++)
+      BOOST_CHECK_EQUAL(key_value_store.disk.get(to_string(100+i)).value(),
+                        "aaa");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_WriteBehind_RepeatedKey) {
+    KeyValueStore<FIFO> key_value_store(20, 1, 1 << 20);
+    for (size_t i = 0; i < 100; i++) {
+      key_value_store.record(to_string(100+i), "aaa");
+      if (i < 3)
+        continue;
+      // a key just evicted, still staged or being appended, asked for twice
+      string const key = to_string(100+i-3);
+      auto const values = key_value_store.retrieve_many({key, key});
+      BOOST_CHECK(values[0] != nullptr && *values[0] == "aaa");
+      BOOST_CHECK(values[1] != nullptr && *values[1] == "aaa");
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_WriteBehind_DeletePromoted) {
+    // values large enough for a retrieve to catch the flusher appending
+    string const value(1 << 22, 'a');
+    KeyValueStore<FIFO> key_value_store(5 << 22, 1, 1 << 30);
+    for (size_t i = 0; i < 40; i++) {
+      key_value_store.record(to_string(100+i), value);
+      if (i < 4)
+        continue;
+      // a key just evicted, promoted maybe while being appended, deleted
+      string const key = to_string(100+i-4);
+      BOOST_CHECK(key_value_store.retrieve(key).value() == value);
+      BOOST_CHECK_EQUAL(key_value_store.del(key), true);
+      BOOST_CHECK_EQUAL(key_value_store.retrieve(key).has_value(), false);
+      BOOST_CHECK_EQUAL(key_value_store.retrieve_many({key})[0], nullptr);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_SharedValues) {
+    KeyValueStore<LRU> key_value_store(20);
+    key_value_store.record("111", "aaa");
+
+    // hits hand out the cached buffer itself, keys may be string views
+    string_view const key = string_view{"111222"}.substr(0, 3);
+    shared_ptr<string const> const first = key_value_store.retrieve_shared(key);
+    shared_ptr<string const> const second = key_value_store.retrieve_shared(key);
+    BOOST_CHECK_EQUAL(*first, "aaa");
+    BOOST_CHECK_EQUAL(first.get(), second.get());
+
+    // a handed out buffer outlives overwriting and deleting its key
+    key_value_store.record("111", "bbb");
+    BOOST_CHECK_EQUAL(key_value_store.del(key), true);
+    BOOST_CHECK_EQUAL(*first, "aaa");
+    BOOST_CHECK_EQUAL(key_value_store.retrieve_shared(key), nullptr);
+
+    // visitors see the value in place
+    key_value_store.record("222", "ccc");
+    size_t length{0};
+    BOOST_CHECK_EQUAL(key_value_store.retrieve_with("222",
+      [&length] (string_view const value) -> void { length = value.length(); }),
+      true);
+    BOOST_CHECK_EQUAL(length, 3);
+    BOOST_CHECK_EQUAL(key_value_store.cache.get_with("222",
+      [] (string_view const value) -> void { BOOST_CHECK_EQUAL(value, "ccc"); }),
+      true);
+  }
+
   BOOST_AUTO_TEST_CASE(Test_KeyValueStore_PickingUpMissingKeysFromDisk) {
     KeyValueStore<FIFO> key_value_store(20);
 
@@ -199,6 +1038,220 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(key_value_store.disk.get("111").has_value(), false);
   }
 
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_Stats) {
+    if (!metrics_enabled)
+      return;
+    KeyValueStore<LRU> key_value_store(20);
+    key_value_store.record("111", "aaa");
+    key_value_store.record("222", "bbb");
+    key_value_store.record("333", "ccc");
+    // "111" goes to the disk
+    key_value_store.record("444", "ddd");
+    key_value_store.retrieve("222");
+    // "333" goes to the disk to make room for "111"
+    key_value_store.retrieve("111");
+    key_value_store.retrieve("999");
+    key_value_store.del("222");
+    // counts of other threads are summed up, also after they ended
+    thread([&key_value_store] () -> void {
+      key_value_store.retrieve("444");
+    }).join();
+
+    Metrics::Stats const stats = key_value_store.stats();
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::Records], 4);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::CacheHits], 2);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::CacheMisses], 2);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::DiskHits], 1);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::DiskMisses], 1);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::Evictions], 2);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::EvictedBytes], 12);
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::Deletes], 1);
+    BOOST_CHECK_EQUAL(stats.cache_hit_ratio(), 0.5);
+    BOOST_CHECK_EQUAL(stats.disk_hit_ratio(), 0.5);
+    BOOST_CHECK_EQUAL(stats[Metrics::Latency::Record].count(), 4);
+    BOOST_CHECK_EQUAL(stats[Metrics::Latency::RetrieveCache].count(), 2);
+    BOOST_CHECK_EQUAL(stats[Metrics::Latency::RetrieveDisk].count(), 1);
+    BOOST_CHECK_EQUAL(stats[Metrics::Latency::RetrieveMiss].count(), 1);
+    BOOST_CHECK_EQUAL(stats[Metrics::Latency::Delete].count(), 1);
+    BOOST_CHECK_EQUAL(stats[Metrics::Latency::DiskWrite].count(), 2);
+    BOOST_CHECK_EQUAL(stats.cache_bytes, key_value_store.cache.size());
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_CompressedValues) {
+    auto const value = [] (size_t const i) -> string {
+      return "{\"id\": " + to_string(i) + ", \"name\": \"" +
+             string(200, alphanum[i % 62]) + "\"}";
+    };
+    // room for 10 plain values, values from 64 bytes on are compressed
+    KeyValueStore<LRU> key_value_store(2200, 1, 0, Cache::Storage::Heap,
+                                       Disk::Lifetime::Temporary, 64);
+    for (size_t i = 0; i < 40; i++)
+      key_value_store.record(to_string(100+i), value(i));
+    key_value_store.record("small", "aaa");
+    BOOST_CHECK_LE(key_value_store.cache.size(), 2200);
+    // every value is still cached, and read back as it was recorded
+    for (size_t i = 0; i < 40; i++) {
+      BOOST_CHECK_EQUAL(key_value_store.cache.get(to_string(100+i)).value(),
+                        value(i));
+      BOOST_CHECK_EQUAL(key_value_store.retrieve(to_string(100+i)).value(),
+                        value(i));
+    }
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("small").value(), "aaa");
+
+    // evicted values reach the disk decompressed
+    for (size_t i = 40; i < 200; i++)
+      key_value_store.record(to_string(100+i), value(i));
+    BOOST_CHECK_EQUAL(key_value_store.disk.get("100").value(), value(0));
+    BOOST_CHECK_EQUAL(key_value_store.retrieve("100").value(), value(0));
+    BOOST_CHECK_EQUAL(*key_value_store.retrieve_many({"101", "102"})[1],
+                      value(2));
+
+    if (!metrics_enabled)
+      return;
+    Metrics::Stats const stats = key_value_store.stats();
+    BOOST_CHECK_EQUAL(stats[Metrics::Event::Compressions], 203);
+    BOOST_CHECK_GT(stats.compression_ratio(), 4.0);
+    BOOST_CHECK_GT(stats[Metrics::Event::Decompressions], 40);
+    BOOST_CHECK_GT(stats[Metrics::Event::CompressionNanos], 0);
+    BOOST_CHECK_GT(stats[Metrics::Event::DecompressionNanos], 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_AsyncRetrieve) {
+    auto const ready = [] (future<shared_ptr<string const>> const& value)
+                       -> bool {
+      return value.wait_for(chrono::seconds(0)) == future_status::ready;
+    };
+    {
+      KeyValueStore<LRU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Temporary, 0, 2);
+      key_value_store.record("111", "aaa");
+      key_value_store.record("222", "bbb");
+      key_value_store.record("333", "ccc");
+      // "111" goes to the disk
+      key_value_store.record("444", "ddd");
+
+      // hits and misses of the whole store complete on the calling thread
+      auto hit = key_value_store.retrieve_async("222");
+      BOOST_CHECK_EQUAL(ready(hit), true);
+      BOOST_CHECK_EQUAL(*hit.get(), "bbb");
+      auto miss = key_value_store.retrieve_async("999");
+      BOOST_CHECK_EQUAL(ready(miss), true);
+      BOOST_CHECK_EQUAL(miss.get() == nullptr, true);
+
+      // a worker reads the disk and promotes the key
+      auto promoted = key_value_store.retrieve_async("111");
+      BOOST_CHECK_EQUAL(*promoted.get(), "aaa");
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("111").value(), "aaa");
+      BOOST_CHECK_EQUAL(key_value_store.disk.get("111").has_value(), false);
+
+      // many lookups in flight at once, each answered with its own value
+      for (size_t i = 0; i < 200; i++)
+        key_value_store.record(to_string(1000+i), to_string(i));
+      vector<future<shared_ptr<string const>>> values;
+      for (size_t i = 0; i < 200; i++)
+        values.push_back(key_value_store.retrieve_async(to_string(1000+i)));
+      for (size_t i = 0; i < 200; i++)
+        BOOST_CHECK_EQUAL(*values[i].get(), to_string(i));
+
+      if (metrics_enabled) {
+        Metrics::Stats const stats = key_value_store.stats();
+        BOOST_CHECK_EQUAL(stats[Metrics::Latency::RetrieveCache].count() +
+                          stats[Metrics::Latency::RetrieveDisk].count() +
+                          stats[Metrics::Latency::RetrieveMiss].count(), 203);
+      }
+    }
+    {
+      // without I/O threads the disk is read on the calling thread
+      KeyValueStore<LRU> key_value_store(8);
+      key_value_store.record("111", "aaa");
+      key_value_store.record("222", "bbb");
+      auto promoted = key_value_store.retrieve_async("111");
+      BOOST_CHECK_EQUAL(ready(promoted), true);
+      BOOST_CHECK_EQUAL(*promoted.get(), "aaa");
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_WarmRestart) {
+    {
+      KeyValueStore<LRU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Persistent);
+      key_value_store.record("111", "aaa");
+      key_value_store.record("222", "bbb");
+      key_value_store.record("333", "ccc");
+      // "111" goes to the disk
+      key_value_store.record("444", "ddd");
+      // least recently used first: "333", "444", "222"
+      key_value_store.retrieve("222");
+    }
+    {
+      KeyValueStore<LRU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Persistent);
+      // the cache and the disk come back as they were left
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("222").value(), "bbb");
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("333").value(), "ccc");
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("444").value(), "ddd");
+      BOOST_CHECK_EQUAL(key_value_store.disk.get("111").value(), "aaa");
+      // and so does the recency order
+      key_value_store.record("555", "eee");
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("333").has_value(), false);
+      BOOST_CHECK_EQUAL(key_value_store.disk.get("333").value(), "ccc");
+    }
+    {
+      KeyValueStore<LFU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Persistent);
+      // the snapshot of another strategy is replayed with LRU's order
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("555").value(), "eee");
+      key_value_store.delAll();
+      key_value_store.record("111", "aaa");
+      key_value_store.record("222", "bbb");
+      key_value_store.retrieve("111");
+      key_value_store.retrieve("111");
+    }
+    {
+      KeyValueStore<LFU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Persistent);
+      // frequencies survive, so the new key pushes out "222" and not "111"
+      key_value_store.record("333", "ccc");
+      key_value_store.record("444", "ddd");
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("111").has_value(), true);
+      BOOST_CHECK_EQUAL(key_value_store.cache.get("222").has_value(), false);
+      key_value_store.delAll();
+    }
+    // the last store wrote a snapshot of its empty cache and disk
+    remove("Storage_snapshot");
+    remove("Storage_snapshot.deleted");
+    remove("Storage_index");
+  }
+
+  BOOST_AUTO_TEST_CASE(Test_KeyValueStore_DeleteAfterCheckpoint) {
+    {
+      KeyValueStore<LRU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Persistent);
+      key_value_store.record("111", "aaa");
+      key_value_store.record("222", "bbb");
+      key_value_store.checkpoint();
+      key_value_store.del("111");
+      // the files as a crash would leave them, before the store closes
+      filesystem::copy_file("Storage_snapshot", "Storage_snapshot.crash");
+      filesystem::copy_file("Storage_snapshot.deleted",
+                            "Storage_snapshot.deleted.crash");
+    }
+    filesystem::rename("Storage_snapshot.crash", "Storage_snapshot");
+    filesystem::rename("Storage_snapshot.deleted.crash",
+                       "Storage_snapshot.deleted");
+    {
+      KeyValueStore<LRU> key_value_store(20, 1, 0, Cache::Storage::Heap,
+                                         Disk::Lifetime::Persistent);
+      // the deleted key does not come back from the snapshot
+      BOOST_CHECK_EQUAL(key_value_store.retrieve("111").has_value(), false);
+      BOOST_CHECK_EQUAL(key_value_store.retrieve("222").value(), "bbb");
+      key_value_store.delAll();
+    }
+    remove("Storage_snapshot");
+    remove("Storage_snapshot.deleted");
+    remove("Storage_index");
+  }
+
   BOOST_AUTO_TEST_CASE(Test_Threading) {
     size_t const number_of_threads = 3;
     vector<thread> threads;
@@ -228,4 +1281,40 @@ BOOST_AUTO_TEST_SUITE(Tests)
     BOOST_CHECK_EQUAL(key_value_store.disk.get("000").value(), "aaa");
   }
 
+  BOOST_AUTO_TEST_CASE(Test_Threading_ByteBudget) {
+    size_t const number_of_threads = 4;
+    size_t const size_max_cache = 200;
+    vector<thread> threads;
+    atomic<bool> done{false}, exceeded{false};
+
+    KeyValueStore<LRU> key_value_store(size_max_cache, 2);
+
+    // the cache is sampled while writers overwrite, grow and shrink records
+    thread monitor([&] () -> void {
+      while (!done.load()) {
+        if (key_value_store.cache.size() > size_max_cache)
+          exceeded.store(true);
+      }
+    });
+    for (size_t i = 0; i < number_of_threads; i++) {
+      threads.emplace_back([&key_value_store, id = i] () -> void {
+        minstd_rand random(static_cast<unsigned>(id+1));
+        for (size_t j = 0; j < 500; j++) {
+          string const key = to_string(random() % 50);
+          if (j % 3 == 0)
+            key_value_store.retrieve(key);
+          else
+            key_value_store.record(key, string(1 + random() % 40, 'v'));
+        }
+      });
+    }
+    for (auto & thread : threads)
+      thread.join();
+    done.store(true);
+    monitor.join();
+
+    BOOST_CHECK_EQUAL(exceeded.load(), false);
+    BOOST_CHECK_LE(key_value_store.cache.size(), size_max_cache);
+  }
+
 BOOST_AUTO_TEST_SUITE_END()